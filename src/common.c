@@ -1,14 +1,42 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 
 #include "common.h"
 #include "log.h"
+#include "stats.h"
 
 
 /* Common argp parser function */
 static error_t handle_common_option(int key,
                                     char* arg,
                                     struct argp_state *state);
+static int common_watch(int epfd,
+                        int op,
+                        int fd,
+                        unsigned int events,
+                        unsigned int source);
+static int common_read_config(const char* filename,
+                              char* name,
+                              int* argc,
+                              char*** argv);
+static int common_setup(common_arguments* args);
+static void common_signals(sigset_t* signals);
+static void common_measure(common_arguments* args);
+static int common_schedule(common_arguments* args);
+static int common_reload(common_arguments* args,
+                         const struct argp* argp,
+                         int argc,
+                         char** argv,
+                         void* input,
+                         int epfd);
 
 /* Common argp option keys */
 enum {
@@ -22,6 +50,21 @@ enum {
         OPTION_PADDING_BOTTOM = 6,
         OPTION_PADDING_LEFT = 7,
 
+        /* Long options only */
+        OPTION_CACHE = 8,
+        OPTION_CACHE_BYTES = 9,
+        OPTION_SKIP_UNCHANGED = 10,
+        OPTION_HEARTBEAT = 11,
+        OPTION_SAMPLE_INTERVAL = 12,
+        OPTION_WINDOW = 13,
+        OPTION_AGGREGATE = 14,
+        OPTION_BACKOFF = 15,
+        OPTION_BACKOFF_THRESHOLD = 16,
+        OPTION_MAX_OVERHEAD = 17,
+        OPTION_OVERHEAD_OVERLAY = 18,
+        OPTION_LOG_LEVEL = 19,
+        OPTION_CONFIG = 20,
+
         /* Preserved: 'g'-'z' and 'A'-'Z' */
         OPTION_WIDTH = 'w',
         OPTION_HEIGHT = 'h',
@@ -39,6 +82,14 @@ enum {
         OPTION_ROUNDING = 'R',
 };
 
+/* Event sources of common_run() */
+enum {
+        SOURCE_TICKER,
+        SOURCE_SAMPLE_TICKER,
+        SOURCE_SIGNAL,
+        SOURCE_OUTPUT,
+};
+
 /* Common options */
 static const struct argp_option common_options[] = {
         { "width",      OPTION_WIDTH,              "WIDTH",     0,
@@ -53,10 +104,29 @@ static const struct argp_option common_options[] = {
           "Margin size in pixels, all four sides"               },
         { "padding",    OPTION_PADDING,            "PADDING",   0,
           "Padding size in pizels, all four sides"              },
-        { "interval",   OPTION_UPDATE_INTERVAL,    "SECONDS",   0,
-          "Polling intetrval in seconds (zero disables polling)"},
+        { "interval",   OPTION_UPDATE_INTERVAL,    "INTERVAL",  0,
+          "Polling interval in seconds, or in milliseconds with \"ms\" (zero disables polling)"},
+        { "render-interval", 0,                    NULL,        OPTION_ALIAS },
+        { "sample-interval", OPTION_SAMPLE_INTERVAL, "INTERVAL", 0,
+          "Sample every INTERVAL, and combine the samples into a bar every polling interval" },
+        { "window",     OPTION_WINDOW,             "SAMPLES",   0,
+          "With --sample-interval, combine the latest SAMPLES samples (default: one polling interval)" },
+        { "aggregate",  OPTION_AGGREGATE,          "METHOD",    0,
+          "With --sample-interval, combine the samples with mean, ema, or max (default: mean)" },
+        { "backoff",    OPTION_BACKOFF,            "INTERVAL",  0,
+          "Poll less often, up to every INTERVAL, while the bar does not change (default: 0, disabled)" },
+        { "backoff-threshold", OPTION_BACKOFF_THRESHOLD, "PIXELS", 0,
+          "With --backoff, changes of up to PIXELS pixels do not count as changes (default: 1)" },
+        { "max-overhead", OPTION_MAX_OVERHEAD,     "PERCENT",   0,
+          "Poll less often if the program uses more than PERCENT of the CPU (default: no limit)" },
+        { "overhead-overlay", OPTION_OVERHEAD_OVERLAY, "COLOR", 0,
+          "Show the share of the CPU the program uses over the bar, in COLOR" },
+        { "config",     OPTION_CONFIG,             "FILE",      0,
+          "Read more options from FILE, one per line, and again on SIGHUP" },
         { "logfile",    OPTION_LOG_FILE,           "LOGFILE",   0,
           "Log debug messages to file"                          },
+        { "log-level",  OPTION_LOG_LEVEL,          "LEVEL",     0,
+          "Log messages of LEVEL or more severe: error, warning, info, or debug (default: info)" },
         { "prefix",     OPTION_PREFIX,             "PREFIX",    0,
           "Prefix to print before the bar"                      },
         { "suffix",     OPTION_SUFFIX,             "SUFFIX",    0,
@@ -69,6 +139,14 @@ static const struct argp_option common_options[] = {
           "Granularity of sections, in pixels"                  },
         { "rounding",   OPTION_ROUNDING,           "WIDTH",     0,
           "Rounding point for sections (default: half of granularity)" },
+        { "cache",      OPTION_CACHE,              "FRAMES",    0,
+          "Cache up to FRAMES rendered frames (default: 0, disabled)" },
+        { "cache-bytes", OPTION_CACHE_BYTES,       "BYTES",     0,
+          "Limit the frame cache to BYTES bytes (default: no limit)" },
+        { "skip-unchanged", OPTION_SKIP_UNCHANGED, NULL,        0,
+          "Do not print the bar if it has not changed"          },
+        { "heartbeat",  OPTION_HEARTBEAT,          "INTERVALS", 0,
+          "With --skip-unchanged, print the bar anyway every INTERVALS intervals (default: 10)" },
         { 0 }
 };
 
@@ -94,62 +172,134 @@ handle_common_option(int key, char* arg, struct argp_state *state)
 {
         error_t err = 0;
         unsigned int int_value = 0;
+        double double_value = 0;
         common_arguments* config = (common_arguments*) state->input;
+        gmbar* bar = config->bar;
+        gmmargin margin = bar->margin;
+        gmmargin padding = bar->padding;
 
         switch (key)
         {
         case OPTION_MARGIN_TOP:
-                err = parse_option_arg_unsigned_char(arg, &config->bar->margin.top);
+                err = parse_option_arg_unsigned_char(arg, &margin.top);
+                gmbar_set_margin(bar, margin);
                 break;
         case OPTION_MARGIN_RIGHT:
-                err = parse_option_arg_unsigned_char(arg, &config->bar->margin.right);
+                err = parse_option_arg_unsigned_char(arg, &margin.right);
+                gmbar_set_margin(bar, margin);
                 break;
         case OPTION_MARGIN_BOTTOM:
-                err = parse_option_arg_unsigned_char(arg, &config->bar->margin.bottom);
+                err = parse_option_arg_unsigned_char(arg, &margin.bottom);
+                gmbar_set_margin(bar, margin);
                 break;
         case OPTION_MARGIN_LEFT:
-                err = parse_option_arg_unsigned_char(arg, &config->bar->margin.left);
+                err = parse_option_arg_unsigned_char(arg, &margin.left);
+                gmbar_set_margin(bar, margin);
                 break;
         case OPTION_PADDING_TOP:
-                err = parse_option_arg_unsigned_char(arg, &config->bar->padding.top);
+                err = parse_option_arg_unsigned_char(arg, &padding.top);
+                gmbar_set_padding(bar, padding);
                 break;
         case OPTION_PADDING_RIGHT:
-                err = parse_option_arg_unsigned_char(arg, &config->bar->padding.right);
+                err = parse_option_arg_unsigned_char(arg, &padding.right);
+                gmbar_set_padding(bar, padding);
                 break;
         case OPTION_PADDING_BOTTOM:
-                err = parse_option_arg_unsigned_char(arg, &config->bar->padding.bottom);
+                err = parse_option_arg_unsigned_char(arg, &padding.bottom);
+                gmbar_set_padding(bar, padding);
                 break;
         case OPTION_PADDING_LEFT:
-                err = parse_option_arg_unsigned_char(arg, &config->bar->padding.left);
+                err = parse_option_arg_unsigned_char(arg, &padding.left);
+                gmbar_set_padding(bar, padding);
                 break;
         case OPTION_WIDTH:
-                err = parse_option_arg_unsigned_int(arg, &config->bar->size.width);
+                err = parse_option_arg_unsigned_int(arg, &int_value);
+                gmbar_set_size(bar, int_value, bar->size.height);
                 break;
         case OPTION_HEIGHT:
-                err = parse_option_arg_unsigned_int(arg, &config->bar->size.height);
+                err = parse_option_arg_unsigned_int(arg, &int_value);
+                gmbar_set_size(bar, bar->size.width, int_value);
                 break;
         case OPTION_FOREGROUND_COLOR:
-                err = parse_option_arg_string(arg, &config->bar->color.fg);
+                err = gmbar_set_color(bar, arg, NULL);
                 break;
         case OPTION_BACKGROUND_COLOR:
-                err = parse_option_arg_string(arg, &config->bar->color.bg);
+                err = gmbar_set_color(bar, NULL, arg);
                 break;
         case OPTION_MARGIN:
                 err = parse_option_arg_unsigned_int(arg, &int_value);
-                config->bar->margin.top = int_value;
-                config->bar->margin.right = int_value;
-                config->bar->margin.bottom = int_value;
-                config->bar->margin.left = int_value;
+                margin.top = int_value;
+                margin.right = int_value;
+                margin.bottom = int_value;
+                margin.left = int_value;
+                gmbar_set_margin(bar, margin);
                 break;
         case OPTION_PADDING:
                 err = parse_option_arg_unsigned_int(arg, &int_value);
-                config->bar->padding.top = int_value;
-                config->bar->padding.right = int_value;
-                config->bar->padding.bottom = int_value;
-                config->bar->padding.left = int_value;
+                padding.top = int_value;
+                padding.right = int_value;
+                padding.bottom = int_value;
+                padding.left = int_value;
+                gmbar_set_padding(bar, padding);
                 break;
         case OPTION_UPDATE_INTERVAL:
-                err = parse_option_arg_unsigned_int(arg, &config->interval);
+                err = parse_option_arg_interval(arg, &config->interval);
+                if (err)
+                {
+                        argp_error(state, "invalid interval: %s", arg);
+                }
+                break;
+        case OPTION_SAMPLE_INTERVAL:
+                err = parse_option_arg_interval(arg, &config->sample_interval);
+                if (err)
+                {
+                        argp_error(state, "invalid interval: %s", arg);
+                }
+                break;
+        case OPTION_WINDOW:
+                err = parse_option_arg_unsigned_int(arg, &config->window_size);
+                break;
+        case OPTION_AGGREGATE:
+                if (strcmp(arg, "mean") == 0)
+                {
+                        config->aggregate = WINDOW_MEAN;
+                }
+                else if (strcmp(arg, "ema") == 0)
+                {
+                        config->aggregate = WINDOW_EMA;
+                }
+                else if (strcmp(arg, "max") == 0)
+                {
+                        config->aggregate = WINDOW_MAX;
+                }
+                else
+                {
+                        err = EINVAL;
+                        argp_error(state, "invalid aggregate: %s", arg);
+                }
+                break;
+        case OPTION_BACKOFF:
+                err = parse_option_arg_interval(arg, &config->backoff);
+                if (err)
+                {
+                        argp_error(state, "invalid interval: %s", arg);
+                }
+                break;
+        case OPTION_BACKOFF_THRESHOLD:
+                err = parse_option_arg_unsigned_int(arg, &config->backoff_threshold);
+                break;
+        case OPTION_MAX_OVERHEAD:
+                err = parse_option_arg_percent(arg, &config->max_overhead);
+                if (err)
+                {
+                        argp_error(state, "invalid percentage: %s", arg);
+                }
+                break;
+        case OPTION_OVERHEAD_OVERLAY:
+                err = parse_option_arg_string(arg, &config->overhead_color);
+                break;
+        case OPTION_CONFIG:
+                err = parse_option_arg_string(arg, &config->config_file);
                 break;
         case OPTION_LOG_FILE:
                 err = log_open(arg);
@@ -158,6 +308,13 @@ handle_common_option(int key, char* arg, struct argp_state *state)
                         err = ENOMEM;
                 }
                 break;
+        case OPTION_LOG_LEVEL:
+                err = log_set_level(arg);
+                if (err)
+                {
+                        argp_error(state, "invalid log level: %s", arg);
+                }
+                break;
         case OPTION_PREFIX:
                 err = parse_option_arg_string(arg, &config->prefix);
                 break;
@@ -165,16 +322,32 @@ handle_common_option(int key, char* arg, struct argp_state *state)
                 err = parse_option_arg_string(arg, &config->suffix);
                 break;
         case OPTION_SEGMENT_WIDTH:
-                err = parse_option_arg_unsigned_int(arg, &config->bar->segment_width);
+                err = parse_option_arg_unsigned_int(arg, &int_value);
+                gmbar_set_segments(bar, int_value, bar->segment_gap);
                 break;
         case OPTION_SEGMENT_GAP:
-                err = parse_option_arg_unsigned_int(arg, &config->bar->segment_gap);
+                err = parse_option_arg_unsigned_int(arg, &int_value);
+                gmbar_set_segments(bar, bar->segment_width, int_value);
                 break;
         case OPTION_GRANULARITY:
-                err = parse_option_arg_unsigned_int(arg, &config->bar->granularity);
+                err = parse_option_arg_unsigned_int(arg, &int_value);
+                gmbar_set_granularity(bar, int_value, bar->rounding);
                 break;
         case OPTION_ROUNDING:
-                err = parse_option_arg_double(arg, &config->bar->rounding);
+                err = parse_option_arg_double(arg, &double_value);
+                gmbar_set_granularity(bar, bar->granularity, double_value);
+                break;
+        case OPTION_CACHE:
+                err = parse_option_arg_unsigned_int(arg, &config->cache_entries);
+                break;
+        case OPTION_CACHE_BYTES:
+                err = parse_option_arg_unsigned_int(arg, &config->cache_bytes);
+                break;
+        case OPTION_SKIP_UNCHANGED:
+                config->skip_unchanged = 1;
+                break;
+        case OPTION_HEARTBEAT:
+                err = parse_option_arg_unsigned_int(arg, &config->heartbeat);
                 break;
 
         default:
@@ -186,6 +359,311 @@ handle_common_option(int key, char* arg, struct argp_state *state)
 }
 
 
+/**
+ * Initializes common arguments to their defaults.
+ *
+ * @param   args   Arguments to initialize
+ * @param   bar    The bar
+ */
+void
+common_arguments_init(common_arguments* args, gmbar* bar)
+{
+        args->bar = bar;
+        args->interval = 15000;
+        args->sample_interval = 0;
+        args->window_size = 0;
+        args->aggregate = WINDOW_MEAN;
+        args->backoff = 0;
+        args->backoff_threshold = 1;
+        args->max_overhead = 0;
+        args->overhead_color = NULL;
+        args->config_file = NULL;
+        args->prefix = NULL;
+        args->suffix = NULL;
+        args->cache_entries = 0;
+        args->cache_bytes = 0;
+        args->skip_unchanged = 0;
+        args->heartbeat = 10;
+        args->renderer = NULL;
+        args->output = NULL;
+        args->ticker = NULL;
+        args->sample_ticker = NULL;
+        args->window = NULL;
+        args->skipped = 0;
+        args->force = 0;
+        args->cpu_time = 0;
+        args->wall_time = 0;
+        args->tick_cpu = 0;
+        args->overhead = 0;
+        stats_reset();
+}
+
+/**
+ * Frees the resources allocated for the common arguments, but not the bar.
+ *
+ * The counters are written to the log.
+ */
+void
+common_arguments_free(common_arguments* args)
+{
+        gmrenderer_free(args->renderer);
+        args->renderer = NULL;
+        output_free(args->output);
+        args->output = NULL;
+        ticker_free(args->ticker);
+        args->ticker = NULL;
+        ticker_free(args->sample_ticker);
+        args->sample_ticker = NULL;
+        window_free(args->window);
+        args->window = NULL;
+        free(args->overhead_color);
+        args->overhead_color = NULL;
+        free(args->config_file);
+        args->config_file = NULL;
+        stats_log();
+}
+
+/**
+ * Parses the command line, and then the file given with --config, if
+ * any, so that the options in the file override those on the command
+ * line.  The renderer, the output, and the tickers are then set up for
+ * the options.
+ *
+ * From here on, the signals handled by common_run() are blocked, so that
+ * those that arrive before the event loop starts, e.g. during the first
+ * sample, wait for it instead of ending the program.
+ *
+ * @param   args    Common arguments, initialized
+ * @param   argp    Argp parser of the program
+ * @param   argc    Argument count of the program
+ * @param   argv    Arguments of the program
+ * @param   input   Argp input of the program
+ * @param   flags   Flags for argp_parse()
+ * @return  Zero on success, errno on failure.
+ */
+int
+common_parse(common_arguments* args,
+             const struct argp* argp,
+             int argc,
+             char** argv,
+             void* input,
+             unsigned int flags)
+{
+        char** file_argv = NULL;
+        sigset_t signals;
+        int file_argc = 0;
+        int i = 0;
+        int err = 0;
+
+        common_signals(&signals);
+        if (sigprocmask(SIG_BLOCK, &signals, NULL) == -1)
+        {
+                err = errno;
+                log_error("Error blocking signals: %d", err);
+                return err;
+        }
+
+        err = argp_parse(argp, argc, argv, flags, NULL, input);
+        if (!err && args->config_file)
+        {
+                err = common_read_config(args->config_file, argv[0], &file_argc, &file_argv);
+                if (!err)
+                {
+                        err = argp_parse(argp, file_argc, file_argv, flags, NULL, input);
+                        for (i = 1; i < file_argc; i++)
+                        {
+                                free(file_argv[i]);
+                        }
+                        free(file_argv);
+                }
+        }
+        if (!err)
+        {
+                err = common_setup(args);
+        }
+        return err;
+}
+
+/**
+ * Sets @signals to the signals handled by common_run().
+ */
+static void
+common_signals(sigset_t* signals)
+{
+        sigemptyset(signals);
+        sigaddset(signals, SIGHUP);
+        sigaddset(signals, SIGUSR1);
+        sigaddset(signals, SIGUSR2);
+        sigaddset(signals, SIGTERM);
+        sigaddset(signals, SIGINT);
+}
+
+/**
+ * Reads the options in a file into an argument vector.
+ *
+ * Each line holds one option as on the command line, with or without
+ * the leading "--", e.g. "fg=red".  Blank lines and lines starting
+ * with '#' are skipped.
+ *
+ * @param   filename   File to read
+ * @param   name       Program name, the first argument
+ * @param   argc       On return, the number of arguments
+ * @param   argv       On return, the arguments, ending with NULL.  All
+ *                     but the first are allocated, as is the vector.
+ * @return  Zero on success, errno on failure.
+ */
+static int
+common_read_config(const char* filename, char* name, int* argc, char*** argv)
+{
+        FILE* file = NULL;
+        char** args = NULL;
+        char** more = NULL;
+        char* line = NULL;
+        char* start = NULL;
+        size_t size = 0;
+        ssize_t len = 0;
+        int count = 1;
+        int err = 0;
+
+        file = fopen(filename, "re");
+        if (!file)
+        {
+                err = errno;
+                log_error("Error opening config file: %d", err);
+                return err;
+        }
+
+        args = (char**) malloc(2 * sizeof(char*));
+        if (!args)
+        {
+                err = ENOMEM;
+        }
+        else
+        {
+                args[0] = name;
+        }
+        while (!err && (len = getline(&line, &size, file)) != -1)
+        {
+                while (len > 0 && isspace(line[len - 1]))
+                {
+                        line[--len] = '\0';
+                }
+                start = line;
+                while (isspace(*start))
+                {
+                        start++;
+                }
+                if (*start == '\0' || *start == '#')
+                {
+                        continue;
+                }
+
+                more = (char**) realloc(args, (count + 2) * sizeof(char*));
+                if (!more)
+                {
+                        err = ENOMEM;
+                        break;
+                }
+                args = more;
+                args[count] = (char*) malloc(strlen(start) + 3);
+                if (!args[count])
+                {
+                        err = ENOMEM;
+                        break;
+                }
+                strcpy(args[count], *start == '-' ? "" : "--");
+                strcat(args[count], start);
+                count++;
+        }
+        if (!err && ferror(file))
+        {
+                err = EIO;
+                log_error("Error reading config file: %d", err);
+        }
+        free(line);
+        fclose(file);
+
+        if (err)
+        {
+                while (args && --count > 0)
+                {
+                        free(args[count]);
+                }
+                free(args);
+                return err;
+        }
+        args[count] = NULL;
+        *argc = count;
+        *argv = args;
+        return 0;
+}
+
+/**
+ * Sets up the renderer, the output, and the tickers for the options
+ * parsed, and throws away the samples in the window.
+ *
+ * Those that exist already are updated rather than created anew, so that
+ * on a reload the frame waiting for a slow consumer is kept and the
+ * event loop keeps watching the same file descriptors.  Only a sampling
+ * ticker that is no longer needed is freed.
+ *
+ * @return  Zero on success, errno on failure.
+ */
+static int
+common_setup(common_arguments* args)
+{
+        int sampling = args->interval && args->sample_interval
+                && args->sample_interval != args->interval;
+        int err = 0;
+
+        if (!args->renderer)
+        {
+                args->renderer = gmrenderer_new();
+        }
+        err = args->renderer
+                ? gmrenderer_set_cache(args->renderer, args->cache_entries, args->cache_bytes)
+                : ENOMEM;
+
+        if (!err && args->output)
+        {
+                err = output_set_affixes(args->output, args->prefix, args->suffix);
+        }
+        else if (!err)
+        {
+                args->output = output_new(1, args->prefix, args->suffix);
+                err = args->output ? 0 : ENOMEM;
+        }
+
+        if (!err && args->interval && args->ticker)
+        {
+                err = ticker_set_interval(args->ticker, args->interval);
+        }
+        else if (!err && args->interval)
+        {
+                args->ticker = ticker_new(args->interval);
+                err = args->ticker ? 0 : ENOMEM;
+        }
+
+        if (!err && !sampling)
+        {
+                ticker_free(args->sample_ticker);
+                args->sample_ticker = NULL;
+        }
+        else if (!err && args->sample_ticker)
+        {
+                err = ticker_set_interval(args->sample_ticker, args->sample_interval);
+        }
+        else if (!err)
+        {
+                args->sample_ticker = ticker_new(args->sample_interval);
+                err = args->sample_ticker ? 0 : ENOMEM;
+        }
+
+        window_free(args->window);
+        args->window = NULL;
+        return err;
+}
+
 /**
  * Parse argument as unsigned integer.
  *
@@ -204,6 +682,61 @@ parse_option_arg_unsigned_int(char* arg, unsigned int* value)
         return 0;
 }
 
+/**
+ * Parse argument as an interval in milliseconds.
+ *
+ * The interval is in seconds ("15", "0.25", "2s"), or in milliseconds
+ * with "ms" suffix ("250ms").  Precision is one millisecond, and an
+ * interval that is not zero but rounds down to zero milliseconds
+ * ("0.5ms") is rejected, as zero has a meaning of its own.
+ *
+ * @param   arg   Argument
+ * @param   val   On return, points to the parsed value
+ * @return  Zero on success, EINVAL if the argument is not an interval.
+ */
+int
+parse_option_arg_interval(char* arg, unsigned int* value)
+{
+        unsigned long long ms = 0;
+        unsigned int scale = 1000;
+        int nonzero = 0;
+        char* end = arg;
+
+        if (!isdigit(*arg))
+        {
+                return EINVAL;
+        }
+        while (isdigit(*end) && ms <= UINT_MAX)
+        {
+                nonzero |= *end != '0';
+                ms = ms * 10 + (*end++ - '0');
+        }
+        ms *= 1000;
+        if (*end == '.')
+        {
+                for (end++; isdigit(*end); end++)
+                {
+                        nonzero |= *end != '0';
+                        scale /= 10;
+                        ms += (*end - '0') * scale;
+                }
+        }
+        if (strcmp(end, "ms") == 0)
+        {
+                ms /= 1000;
+        }
+        else if (*end && strcmp(end, "s"))
+        {
+                return EINVAL;
+        }
+        if (ms > UINT_MAX || (nonzero && ms == 0))
+        {
+                return EINVAL;
+        }
+        *value = ms;
+        return 0;
+}
+
 /**
  * Parse argument as double
  *
@@ -218,6 +751,31 @@ parse_option_arg_double(char* arg, double* value)
         return 0;
 }
 
+/**
+ * Parse argument as a percentage in parts per million.
+ *
+ * The argument is a decimal number of percents, optionally followed by
+ * "%" ("0.1", "0.1%").  Precision is 0.0001%.
+ *
+ * @param   arg   Argument
+ * @param   val   On return, points to the parsed value
+ * @return  Zero on success, EINVAL if the argument is not a percentage.
+ */
+int
+parse_option_arg_percent(char* arg, unsigned int* value)
+{
+        char* end = NULL;
+        double percent = strtod(arg, &end);
+
+        if (end == arg || (*end && strcmp(end, "%"))
+            || !(percent >= 0 && percent <= 100))
+        {
+                return EINVAL;
+        }
+        *value = percent * 10000 + 0.5;
+        return 0;
+}
+
 /**
  * Parse argument as unsigned char.
  *
@@ -261,71 +819,483 @@ parse_option_arg_string(char* arg, char** str)
 }
 
 /**
- * Find @str in @mem.
+ * Sets the widths of the sections of the bar from a sample.
  *
- * If @str is zero length or NULL, @mem is returned.
+ * If the bar is sampled more often than printed, the sample is added to
+ * the window instead, and the widths are set when the bar is printed.
  *
- * @param   mem    Memory buffer from which to search
- * @param   str    Zero terminated string to search
- * @param   size   Size of the mem buffer in bytes
- * @return  
+ * @param   total    Total value
+ * @param   values   Values, one per section
+ * @return  Zero on success, errno on failure.
  */
-const char*
-memstr(const char* mem, const char* str, unsigned int size)
+int
+common_sample(common_arguments* args, unsigned int total, const unsigned int* values)
 {
-        const size_t len = str ? strlen(str) : 0;
-
-        if (len == 0)
-                return mem;
+        unsigned int size = args->window_size;
+        stats_timer timer;
 
-        while (size >= len)
+        if (!args->sample_ticker)
         {
-                if (memcmp(mem, str, len) == 0)
-                        return mem;
-                mem++;
-                size--;
+                stats_timer_start(&timer);
+                gmbar_set_section_widths(args->bar, total, values);
+                stats_timer_stop(&timer, STATS_WIDTHS);
+                return 0;
         }
 
-        return NULL;
+        if (!args->window)
+        {
+                if (!size)
+                {
+                        size = (args->interval + args->sample_interval - 1) / args->sample_interval;
+                }
+                args->window = window_new(size, args->bar->nsections, args->aggregate);
+                if (!args->window)
+                {
+                        return ENOMEM;
+                }
+        }
+        stats_timer_start(&timer);
+        window_add(args->window, total, values);
+        stats_timer_stop(&timer, STATS_WIDTHS);
+        return 0;
 }
 
 /**
+ * Prints the bar to stdout, with the prefix and the suffix.
+ *
+ * If there is a window of samples, the widths of the sections are set
+ * from the combined samples first.
  *
+ * With --skip-unchanged, the bar is not printed if it is the same as
+ * the previous one, unless a heartbeat is due or the frame is forced.
+ *
+ * @return  Zero on success, errno on failure.
  */
 int
 print_bar(common_arguments* args)
 {
-        static char* buf = NULL;
-        static int len = 0;
-        static int max = 0;
+        gmrenderer* renderer = args->renderer;
+        struct iovec parts[2];
+        stats_timer timer;
+        char overlay[128];
+        char error[64];
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+        int len = 0;
+        int err = 0;
+
+        if (args->window)
+        {
+                stats_timer_start(&timer);
+                gmbar_set_section_widths(args->bar, WINDOW_ONE, window_aggregate(args->window));
+                stats_timer_stop(&timer, STATS_WIDTHS);
+        }
+
+        if (args->skip_unchanged)
+        {
+                if (!args->force
+                    && gmrenderer_unchanged(renderer, args->bar)
+                    && (args->heartbeat == 0 || ++args->skipped < args->heartbeat))
+                {
+                        return 0;
+                }
+                args->skipped = 0;
+        }
+        args->force = 0;
+
+        if (renderer->cache)
+        {
+                hits = renderer->cache->hits;
+                misses = renderer->cache->misses;
+        }
+        /* Only frames actually formatted are timed, so that skipped
+         * frames do not pull the latency of the stage down */
+        stats_timer_start(&timer);
+        err = gmrenderer_format(renderer, args->bar);
+        stats_timer_stop(&timer, STATS_FORMAT);
+        if (renderer->cache)
+        {
+                stats_add(STATS_CACHE_HITS, renderer->cache->hits - hits);
+                stats_add(STATS_CACHE_MISSES, renderer->cache->misses - misses);
+        }
+
+        stats_timer_start(&timer);
+        if (err < 0)
+        {
+                err = -err;
+                len = snprintf(error, sizeof(error), "^fg(red)^bg(black)%d^bg()^fg()", err);
+                output_write(args->output, error, len);
+                stats_timer_stop(&timer, STATS_WRITE);
+                return err;
+        }
+
+        parts[0].iov_base = renderer->buf;
+        parts[0].iov_len  = renderer->len;
+        if (args->overhead_color)
+        {
+                /* Over the left end of the bar, then back to the end */
+                len = snprintf(overlay, sizeof(overlay),
+                               "^p(_LOCK_X)^p(-%u)^fg(%s)%u.%04u%%^fg()^p(_UNLOCK_X)",
+                               args->bar->size.width, args->overhead_color,
+                               args->overhead / 10000, args->overhead % 10000);
+                parts[1].iov_base = overlay;
+                parts[1].iov_len  = len < (int) sizeof(overlay) ? len : 0;
+        }
+        err = output_writev(args->output, parts, args->overhead_color ? 2 : 1);
+        stats_timer_stop(&timer, STATS_WRITE);
+        return err;
+}
+
+
+/**
+ * Runs the event loop until an error occurs, or until SIGTERM or SIGINT.
+ *
+ * A sample is taken and the bar is printed on every tick of the ticker.
+ * With a sampling ticker, the samples are taken on its ticks instead.
+ * The signals are handled in the loop:
+ *
+ *   SIGHUP    The command line and the file given with --config are
+ *             parsed again, which reopens the log file, and the prefix,
+ *             the suffix, the tickers, and the frame cache are updated
+ *             and the window emptied.  The bar, the sampling state, and
+ *             a frame waiting for the consumer are kept.
+ *   SIGUSR1   A sample is taken and the bar is printed right away.
+ *   SIGUSR2   The counters and the latency histograms are written to
+ *             the log.
+ *   SIGTERM   The loop ends, so that the program can clean up and write
+ *   SIGINT    the counters to the log on exit.
+ *
+ * While a frame is waiting for a slow consumer, the output is flushed as
+ * soon as it becomes writable.
+ *
+ * With --backoff, the polling interval doubles every time the bar has
+ * not changed, up to the backoff interval, and returns to the polling
+ * interval as soon as it changes.  With --max-overhead, the polling
+ * interval is stretched so that a tick uses at most the given share of
+ * the CPU.
+ *
+ * If polling is disabled, unblocks the signals and returns immediately.
+ *
+ * @param   args     Common arguments, parsed
+ * @param   argp     Argp parser of the program
+ * @param   argc     Argument count of the program
+ * @param   argv     Arguments of the program
+ * @param   input    Argp input of the program
+ * @param   sample   Callback to take a sample
+ * @param   data     Data for the callback
+ * @return  Zero after SIGTERM or SIGINT, errno on failure.
+ */
+int
+common_run(common_arguments* args,
+           const struct argp* argp,
+           int argc,
+           char** argv,
+           void* input,
+           common_sample_func sample,
+           void* data)
+{
+        struct epoll_event events[4];
+        struct signalfd_siginfo info;
+        sigset_t signals;
+        stats_timer timer;
+        ssize_t bytes = 0;
+        int epfd = -1;
+        int sigfd = -1;
+        int writing = 0;
+        int reloaded = 0;
+        int done = 0;
+        int n = 0;
+        int i = 0;
         int err = 0;
 
-        len = 0;
-        err = gmbar_format(args->bar, 0, &buf, &len, &max);
+        /* Blocked by common_parse() already; the signals that came in
+         * since then are read from the signalfd */
+        common_signals(&signals);
+        if (!args->ticker)
+        {
+                sigprocmask(SIG_UNBLOCK, &signals, NULL);
+                return 0;
+        }
+
+        sigfd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (sigfd == -1 || epfd == -1)
+        {
+                err = errno;
+                log_error("Error creating event loop: %d", err);
+        }
         if (!err)
         {
-                if (args->prefix && args->suffix)
+                err = common_watch(epfd, EPOLL_CTL_ADD, sigfd, EPOLLIN, SOURCE_SIGNAL);
+        }
+        if (!err)
+        {
+                err = common_watch(epfd, EPOLL_CTL_ADD, args->ticker->fd, EPOLLIN, SOURCE_TICKER);
+        }
+        if (!err && args->sample_ticker)
+        {
+                err = common_watch(epfd, EPOLL_CTL_ADD, args->sample_ticker->fd, EPOLLIN, SOURCE_SAMPLE_TICKER);
+        }
+
+        common_measure(args);
+
+        while (!err && !done)
+        {
+                /* Wait for the consumer only while there is something to
+                 * write, the output is always writable otherwise */
+                if (output_busy(args->output) != writing)
                 {
-                        printf("%s%s%s\n", args->prefix, buf, args->suffix);
+                        writing = !writing;
+                        err = common_watch(epfd, writing ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+                                           args->output->fd, EPOLLOUT, SOURCE_OUTPUT);
+                        if (err)
+                        {
+                                break;
+                        }
                 }
-                else if (args->prefix)
+
+                /* Wake up to write the log records waiting in memory */
+                log_tick();
+                n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]),
+                               log_pending() ? 1000 : -1);
+                if (n == -1)
                 {
-                        printf("%s%s\n", args->prefix, buf);
+                        if (errno == EINTR)
+                        {
+                                continue;
+                        }
+                        err = errno;
+                        log_error("Error waiting for events: %d", err);
+                        break;
                 }
-                else if (args->suffix)
+                stats_add(STATS_WAKEUPS, 1);
+
+                /* After a reload, the rest of the events may refer to
+                 * the old ticker; they are reported again if still due */
+                reloaded = 0;
+                for (i = 0; i < n && !err && !reloaded && !done; i++)
                 {
-                        printf("%s%s\n", buf, args->suffix);
+                        switch (events[i].data.u32)
+                        {
+                        case SOURCE_TICKER:
+                                err = ticker_wait(args->ticker);
+                                common_measure(args);
+                                if (!err && !args->sample_ticker)
+                                {
+                                        err = sample(data);
+                                }
+                                if (!err)
+                                {
+                                        err = common_schedule(args);
+                                }
+                                if (!err)
+                                {
+                                        err = print_bar(args);
+                                }
+                                break;
+
+                        case SOURCE_SAMPLE_TICKER:
+                                err = ticker_wait(args->sample_ticker);
+                                if (!err)
+                                {
+                                        err = sample(data);
+                                }
+                                break;
+
+                        case SOURCE_OUTPUT:
+                                stats_timer_start(&timer);
+                                err = output_flush(args->output);
+                                stats_timer_stop(&timer, STATS_WRITE);
+                                break;
+
+                        case SOURCE_SIGNAL:
+                                while (!err && !reloaded && !done)
+                                {
+                                        bytes = read(sigfd, &info, sizeof(info));
+                                        if (bytes != sizeof(info))
+                                        {
+                                                break;
+                                        }
+                                        switch (info.ssi_signo)
+                                        {
+                                        case SIGHUP:
+                                                err = common_reload(args, argp, argc, argv, input, epfd);
+                                                reloaded = 1;
+                                                break;
+                                        case SIGUSR1:
+                                                args->force = 1;
+                                                err = sample(data);
+                                                if (!err)
+                                                {
+                                                        err = common_schedule(args);
+                                                }
+                                                if (!err)
+                                                {
+                                                        err = print_bar(args);
+                                                }
+                                                break;
+                                        case SIGUSR2:
+                                                stats_log();
+                                                break;
+                                        case SIGTERM:
+                                        case SIGINT:
+                                                done = 1;
+                                                break;
+                                        }
+                                }
+                                break;
+                        }
                 }
-                else
+        }
+
+        if (epfd != -1)
+        {
+                close(epfd);
+        }
+        if (sigfd != -1)
+        {
+                close(sigfd);
+        }
+        sigprocmask(SIG_UNBLOCK, &signals, NULL);
+        return err;
+}
+
+/**
+ * Measures the CPU time used by the process since the previous polling
+ * tick.
+ */
+static void
+common_measure(common_arguments* args)
+{
+        struct timespec now;
+        unsigned long long cpu_time = stats_cpu_time();
+        unsigned long long wall_time = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        wall_time = now.tv_sec * 1000000000ULL + now.tv_nsec;
+        if (args->wall_time && wall_time > args->wall_time)
+        {
+                args->tick_cpu = cpu_time - args->cpu_time;
+                args->overhead = args->tick_cpu * 1000000 / (wall_time - args->wall_time);
+        }
+        args->cpu_time = cpu_time;
+        args->wall_time = wall_time;
+}
+
+/**
+ * Adapts the polling interval to the CPU budget, and to how much the bar
+ * has changed since the last frame.  Does nothing if the samples have
+ * their own ticker.
+ *
+ * @return  Zero on success, errno on failure.
+ */
+static int
+common_schedule(common_arguments* args)
+{
+        unsigned long long needed = 0;
+        unsigned int base = args->interval;
+        unsigned int interval = args->ticker->interval;
+
+        if (args->sample_ticker)
+        {
+                return 0;
+        }
+
+        /* The shortest interval at which a tick costs at most the
+         * budget, in milliseconds */
+        if (args->max_overhead)
+        {
+                needed = args->tick_cpu / args->max_overhead;
+                if (needed > base)
                 {
-                        printf("%s\n", buf);
+                        base = needed < UINT_MAX ? needed : UINT_MAX;
                 }
         }
-        else
+
+        if (!args->backoff
+            || gmrenderer_change(args->renderer, args->bar) > args->backoff_threshold)
+        {
+                interval = base;
+        }
+        else if (interval < args->backoff)
         {
-                printf("^fg(red)^bg(black)%d^bg()^fg()\n", err);
+                interval = interval < args->backoff / 2 ? interval * 2 : args->backoff;
+        }
+        if (interval < base)
+        {
+                interval = base;
+        }
+
+        if (interval == args->ticker->interval)
+        {
+                return 0;
+        }
+        return ticker_set_interval(args->ticker, interval);
+}
+
+/**
+ * Adds, modifies, or removes a file descriptor in the event loop.
+ *
+ * @param   epfd     Epoll file descriptor
+ * @param   op       EPOLL_CTL_ADD, EPOLL_CTL_MOD, or EPOLL_CTL_DEL
+ * @param   fd       File descriptor to watch
+ * @param   events   Epoll events to watch for
+ * @param   source   Event source, reported back with the events
+ * @return  Zero on success, errno on failure.
+ */
+static int
+common_watch(int epfd, int op, int fd, unsigned int events, unsigned int source)
+{
+        struct epoll_event event;
+        int err = 0;
+
+        memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.u32 = source;
+        if (epoll_ctl(epfd, op, fd, &event) == -1)
+        {
+                err = errno;
+                log_error("Error watching file descriptor %d: %d", fd, err);
         }
-        fflush(stdout);
         return err;
 }
 
+/**
+ * Parses the command line and the file given with --config again,
+ * keeping the bar, and watches the new sampling ticker, if any, in the
+ * event loop.
+ *
+ * If the options can not be parsed, the error is logged and the program
+ * goes on with the options parsed so far.
+ *
+ * @param   epfd   Epoll file descriptor of the event loop
+ * @return  Zero on success, errno on failure.
+ */
+static int
+common_reload(common_arguments* args,
+              const struct argp* argp,
+              int argc,
+              char** argv,
+              void* input,
+              int epfd)
+{
+        /* A sampling ticker that is freed leaves the event loop as its
+         * file descriptor is closed; the others are kept */
+        int sampling = args->sample_ticker != NULL;
+        int err = 0;
+
+        err = common_parse(args, argp, argc, argv, input, ARGP_NO_EXIT);
+        if (err)
+        {
+                log_error("Error reloading options: %d", err);
+                err = common_setup(args);
+        }
+        gmbar_invalidate(args->bar);
+        args->skipped = 0;
+
+        if (!err && args->sample_ticker && !sampling)
+        {
+                err = common_watch(epfd, EPOLL_CTL_ADD, args->sample_ticker->fd, EPOLLIN, SOURCE_SAMPLE_TICKER);
+        }
+        return err;
+}
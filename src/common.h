@@ -1,11 +1,16 @@
 #include <argp.h>
 #include "libgmbar.h"
+#include "output.h"
+#include "ticker.h"
+#include "window.h"
 
 #ifndef COMMON_H
 #define COMMON_H
 
 int parse_option_arg_unsigned_int(char* arg, unsigned int* val);
+int parse_option_arg_interval(char* arg, unsigned int* val);
 int parse_option_arg_double(char* arg, double* val);
+int parse_option_arg_percent(char* arg, unsigned int* val);
 int parse_option_arg_unsigned_char(char* arg, unsigned char* val);
 int parse_option_arg_string(char* arg, char** str);
 
@@ -16,15 +21,97 @@ extern const struct argp_child common_argp_child[];
 typedef struct common_arguments common_arguments;
 struct common_arguments {
         gmbar* bar;
+        /** Polling interval in milliseconds, zero disables polling */
         unsigned int interval;
+        /** Sampling interval in milliseconds, zero to sample once per
+         * polling interval */
+        unsigned int sample_interval;
+        /** Number of samples combined into a bar, zero for the number of
+         * samples in one polling interval */
+        unsigned int window_size;
+        /** How the samples are combined, e.g. WINDOW_MEAN */
+        int aggregate;
+        /** Longest polling interval in milliseconds while the bar does
+         * not change, zero disables backing off */
+        unsigned int backoff;
+        /** Largest change of a section in pixels that counts as no change */
+        unsigned int backoff_threshold;
+        /** Largest share of the CPU to use, in parts per million, zero for
+         * no limit */
+        unsigned int max_overhead;
+        /** Color of the overhead shown over the bar, or NULL to not show */
+        char* overhead_color;
+        /** File of more options given with --config, read again on
+         * SIGHUP, or NULL */
+        char* config_file;
         char* prefix;
         char* suffix;
+        /** Maximum number of frames in the frame cache, zero disables */
+        unsigned int cache_entries;
+        /** Maximum size of the frame cache in bytes, zero for no limit */
+        unsigned int cache_bytes;
+        /** If non-zero, frames identical to the previous one are not printed */
+        unsigned int skip_unchanged;
+        /** Print an unchanged frame anyway every this many frames, zero never */
+        unsigned int heartbeat;
+        /** Renderer for the bar, created when the options have been parsed */
+        gmrenderer* renderer;
+        /** Output for the bar, created when the options have been parsed */
+        output* output;
+        /** Polling ticker, created when the options have been parsed, or
+         * NULL if polling is disabled */
+        ticker* ticker;
+        /** Sampling ticker, or NULL if the bar is sampled once per
+         * polling interval */
+        ticker* sample_ticker;
+        /** Samples combined into the bar, created on the first sample if
+         * there is a sampling ticker, NULL otherwise */
+        window* window;
+        /** Number of unchanged frames not printed since the last one printed */
+        unsigned int skipped;
+        /** If non-zero, the next frame is printed even if it is unchanged */
+        unsigned int force;
+        /** CPU time used by the process at the latest polling tick, in
+         * nanoseconds */
+        unsigned long long cpu_time;
+        /** Time of the latest polling tick, in nanoseconds */
+        unsigned long long wall_time;
+        /** CPU time used between the two latest polling ticks, in
+         * nanoseconds */
+        unsigned long long tick_cpu;
+        /** Share of the CPU used between the two latest polling ticks, in
+         * parts per million */
+        unsigned int overhead;
 };
 
-const char*   memstr   (const char* data,
-                        const char* str,
-                        unsigned int size);
+/**
+ * Callback to take a sample and hand it to common_sample().
+ *
+ * @param   data   Data given to common_run()
+ * @return  Zero on success, errno on failure.
+ */
+typedef int (*common_sample_func)(void* data);
 
+void common_arguments_init(common_arguments* args, gmbar* bar);
+void common_arguments_free(common_arguments* args);
+int common_parse(common_arguments* args,
+                 const struct argp* argp,
+                 int argc,
+                 char** argv,
+                 void* input,
+                 unsigned int flags);
+
+int common_sample(common_arguments* args,
+                  unsigned int total,
+                  const unsigned int* values);
 int print_bar(common_arguments* args);
 
+int common_run(common_arguments* args,
+               const struct argp* argp,
+               int argc,
+               char** argv,
+               void* input,
+               common_sample_func sample,
+               void* data);
+
 #endif //COMMON_H
@@ -1,39 +1,63 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 
 #include "libgmbar.h"
 #include "common.h"
 #include "log.h"
+#include "stats.h"
 #include "readfile.h"
+#include "procfile.h"
 #include "buffer.h"
 #include "version.h"
 
-/* Maximum length of a CPU field label in /proc/stat ('cpu[CPU_INDEX] ') */
-#define MAX_CPU_FIELD_LEN 20
+/* Counters of one "cpu" line in /proc/stat */
+typedef struct cpu_stat cpu_stat;
+struct cpu_stat {
+        /** Non-zero if the line was found from the latest snapshot */
+        unsigned int present;
+        unsigned int kern;
+        unsigned int user;
+        unsigned int nice;
+        unsigned int idle;
+};
+
+/* Counters of all the "cpu" lines in /proc/stat.  Slot zero holds the
+ * aggregate "cpu" line, and slot N + 1 holds the line of CPU N. */
+typedef struct cpu_table cpu_table;
+struct cpu_table {
+        /** Number of slots in use */
+        unsigned int len;
+        /** Number of slots allocated */
+        unsigned int max;
+        /** Slots */
+        cpu_stat* cpus;
+};
 
 /* Static functions */
 static error_t handle_option(int key,
                              char* arg,
                              struct argp_state *state);
-static int get_stat(buffer* stat,
-                    const char* field,
-                    unsigned int *kern,
-                    unsigned int *user,
-                    unsigned int *nice,
-                    unsigned int *idle);
-static long get_num_cpus();
-static long parse_cpuinfo(const char* cpuinfo,
-                          const unsigned int size);
+static int get_stat(procfile* file,
+                    buffer* stat,
+                    cpu_table* table);
+static int cpu_exists(long cpu,
+                      const cpu_table* table);
+static int parse_cpu_list(const char* list,
+                          const unsigned int size,
+                          long cpu);
 static int parse_stat(const char* stat,
                       const unsigned int size,
-                      const char* field,
-                      unsigned int *kern,
-                      unsigned int *user,
-                      unsigned int *nice,
-                      unsigned int *idle);
+                      cpu_table* table);
+static int cpu_table_reserve(cpu_table* table,
+                             unsigned int len);
+static unsigned int parse_counter(const char** str,
+                                  const char* end);
 static unsigned int parse_unsigned_int(const char* str,
                                        const char** end);
+static int sample(void* data);
 
 
 /* Argp option keys (available: 'a'-'f') */
@@ -43,6 +67,10 @@ enum {
         OPTION_NICE_COLOR = 'c',
         OPTION_IDLE_COLOR = 'd',
         OPTION_CPU_INDEX  = 'f',
+
+        /* Long options only, after the common ones */
+        OPTION_BOOTSTRAP = 256,
+        OPTION_PLACEHOLDER = 257,
 };
 
 
@@ -51,6 +79,26 @@ typedef struct arguments arguments;
 struct arguments {
         common_arguments common_config;
         int cpu_index;
+        /** Interval of the first sample in milliseconds, zero disables */
+        unsigned int bootstrap;
+        /** If non-zero, an empty bar is printed before the first sample */
+        unsigned int placeholder;
+};
+
+/* State kept between the samples */
+typedef struct sampler sampler;
+struct sampler {
+        arguments* config;
+        procfile* statfile;
+        buffer* stat;
+        /** Counters of all the CPUs in the latest sample */
+        cpu_table cpus;
+        /** Slot of the watched CPU in the table */
+        unsigned int cpu_slot;
+        /** Non-zero if the watched CPU was online in the previous sample */
+        int online;
+        /** Counters of the watched CPU in the previous sample */
+        cpu_stat prev;
 };
 
 /* Options */
@@ -65,6 +113,10 @@ static struct argp_option options[] = {
           "Color for the idle portion of the bar"               },
         { "cpu",        OPTION_CPU_INDEX,          "INDEX",     0,
           "Index of the processor to watch"                     },
+        { "bootstrap",  OPTION_BOOTSTRAP,          "INTERVAL",  0,
+          "Print the first bar after INTERVAL (default: 100ms, 0 waits for the first polling interval)" },
+        { "placeholder", OPTION_PLACEHOLDER,       NULL,        0,
+          "Print an empty bar right away"                       },
         { 0 }
 };
 
@@ -78,25 +130,31 @@ int
 main(int argc, char** argv)
 {
         int err = 0;
-        long total; // Number of clock ticks per second
-        long num_cpus;
-        char cpu_field[MAX_CPU_FIELD_LEN + 1];
-        unsigned int _kern, _user, _nice, _idle;
-        unsigned int kern, user, nice, idle;
+        struct timespec delay;
         arguments config;
+        sampler state;
+        procfile* statfile = NULL;
         buffer* stat = NULL;
         gmbar* bar = NULL;
 
+        statfile = procfile_new("/proc/stat");
+        if (!statfile)
+        {
+                return -1;
+        }
+
         stat = buffer_new();
         if (!stat)
         {
+                procfile_free(statfile);
                 return -1;
         }
 
-        bar = gmbar_new_with_defaults(100, 10, "red", "none");
+        bar = gmbar_new_with_defaults(100, 10, "red", "none", 4);
         if (!bar)
         {
                 buffer_free(stat);
+                procfile_free(statfile);
                 return -1;
         }
 
@@ -104,89 +162,161 @@ main(int argc, char** argv)
         if (err)
         {
                 buffer_free(stat);
+                procfile_free(statfile);
                 gmbar_free(bar);
                 return -1;
         }
 
         config.cpu_index = -1;
-        config.common_config.bar = bar;
-        config.common_config.interval = 15;
-        config.common_config.prefix = NULL;
-        config.common_config.suffix = NULL;
-        err = argp_parse(&argp, argc, argv, 0, NULL, &config);
+        config.bootstrap = 100;
+        config.placeholder = 0;
+        common_arguments_init(&config.common_config, bar);
+        err = common_parse(&config.common_config, &argp, argc, argv, &config, 0);
         if (err)
         {
                 buffer_free(stat);
+                procfile_free(statfile);
+                common_arguments_free(&config.common_config);
                 gmbar_free(bar);
                 return err;
         }
 
-        /* Clock ticks per second (per CPU) */
-        total = sysconf(_SC_CLK_TCK);
+        if (config.placeholder)
+        {
+                err = print_bar(&config.common_config);
+                if (err)
+                {
+                        buffer_free(stat);
+                        procfile_free(statfile);
+                        common_arguments_free(&config.common_config);
+                        gmbar_free(bar);
+                        return err;
+                }
+        }
+
+        state.config = &config;
+        state.statfile = statfile;
+        state.stat = stat;
+        state.cpus.len = 0;
+        state.cpus.max = 0;
+        state.cpus.cpus = NULL;
+        state.cpu_slot = 0;
 
-        /* Number of CPUs */
-        num_cpus = get_num_cpus();
-        if (num_cpus < 0)
+        /* Initialize history */
+        err = get_stat(statfile, stat, &state.cpus);
+        if (err)
         {
                 buffer_free(stat);
+                procfile_free(statfile);
+                free(state.cpus.cpus);
+                common_arguments_free(&config.common_config);
                 gmbar_free(bar);
-                return num_cpus;
+                return err;
         }
+
         if (config.cpu_index >= 0
-            && config.cpu_index <= CHAR_MAX
-            && config.cpu_index < num_cpus)
+            && cpu_exists(config.cpu_index, &state.cpus))
         {
-                snprintf(cpu_field, MAX_CPU_FIELD_LEN, "cpu%i ", config.cpu_index);
+                state.cpu_slot = config.cpu_index + 1;
+        }
+
+        state.online = state.cpu_slot < state.cpus.len
+                && state.cpus.cpus[state.cpu_slot].present;
+        if (state.online)
+        {
+                state.prev = state.cpus.cpus[state.cpu_slot];
         }
         else
         {
-                snprintf(cpu_field, MAX_CPU_FIELD_LEN, "cpu ");
+                log_warning("CPU is offline: %d", config.cpu_index);
         }
 
-        /* Initialize history */
-        err = get_stat(stat, cpu_field, &_kern, &_user, &_nice, &_idle);
-        if (err)
+        /* Take the first sample after a short bootstrap interval, so
+         * that the bar is shown without waiting a full interval */
+        if (config.bootstrap
+            && (config.bootstrap < config.common_config.interval
+                || !config.common_config.interval))
         {
-                buffer_free(stat);
-                gmbar_free(bar);
-                return err;
+                delay.tv_sec = config.bootstrap / 1000;
+                delay.tv_nsec = config.bootstrap % 1000 * 1000000L;
+                while (nanosleep(&delay, &delay) == -1 && errno == EINTR)
+                        ;
+                err = sample(&state);
+                if (!err)
+                {
+                        err = print_bar(&config.common_config);
+                }
         }
 
-        while (config.common_config.interval)
+        if (!err)
         {
-                sleep(config.common_config.interval);
+                err = common_run(&config.common_config, &argp, argc, argv, &config,
+                                 sample, &state);
+        }
 
-                err = get_stat(stat, cpu_field, &kern, &user, &nice, &idle);
-                if (err)
-                {
-                        buffer_free(stat);
-                        gmbar_free(bar);
-                        return err;
-                }
+        buffer_free(stat);
+        procfile_free(statfile);
+        free(state.cpus.cpus);
+        common_arguments_free(&config.common_config);
+        gmbar_free(bar);
+        return err;
+}
+
+/**
+ * Reads /proc/stat and samples the CPU usage since the previous sample.
+ *
+ * @param   data   The sampler
+ * @return  Zero on success, errno on failure.
+ */
+static int
+sample(void* data)
+{
+        sampler* state = (sampler*) data;
+        arguments* config = state->config;
+        cpu_table* cpus = &state->cpus;
+        unsigned int cpu_slot = state->cpu_slot;
+        unsigned long long total;
+        unsigned int values[4];
+        cpu_stat* cur = NULL;
+        int err = 0;
 
-                /* total is not accurate */
-                total = (kern - _kern) + (user - _user) + (nice - _nice) + (idle - _idle);
+        err = get_stat(state->statfile, state->stat, cpus);
+        if (err)
+        {
+                return err;
+        }
 
-                gmbar_set_section_width(bar->sections[0], total, kern - _kern);
-                gmbar_set_section_width(bar->sections[1], total, user - _user);
-                gmbar_set_section_width(bar->sections[2], total, nice - _nice);
-                gmbar_set_section_width(bar->sections[3], total, idle - _idle);
+        cur = cpu_slot < cpus->len && cpus->cpus[cpu_slot].present
+                ? &cpus->cpus[cpu_slot] : NULL;
 
-                err = print_bar(&config.common_config);
-                if (err)
+        if (!cur || !state->online)
+        {
+                /* CPU went offline or came back online, there is
+                 * no history to compare against */
+                if (!cur != !state->online)
                 {
-                        buffer_free(stat);
-                        gmbar_free(bar);
-                        return err;
+                        log_warning(cur ? "CPU is online: %d" : "CPU is offline: %d",
+                                  config->cpu_index);
                 }
+                total = 0;
+                memset(values, 0, sizeof(values));
+        }
+        else
+        {
+                values[0] = cur->kern - state->prev.kern;
+                values[1] = cur->user - state->prev.user;
+                values[2] = cur->nice - state->prev.nice;
+                values[3] = cur->idle - state->prev.idle;
+                total = (unsigned long long) values[0] + values[1] + values[2] + values[3];
+        }
+        state->online = cur != NULL;
 
-                _kern = kern;
-                _user = user;
-                _nice = nice;
-                _idle = idle;
+        if (cur)
+        {
+                state->prev = *cur;
         }
 
-        return 0;
+        return common_sample(&config->common_config, total, values);
 }
 
 static error_t
@@ -202,20 +332,30 @@ handle_option(int key, char* arg, struct argp_state *state)
                 break;
 
         case OPTION_KERN_COLOR:
-                err = parse_option_arg_string(arg, &config->common_config.bar->sections[0]->color);
+                err = gmbar_set_section_color(&config->common_config.bar->sections[0], arg);
                 break;
         case OPTION_USER_COLOR:
-                err = parse_option_arg_string(arg, &config->common_config.bar->sections[1]->color);
+                err = gmbar_set_section_color(&config->common_config.bar->sections[1], arg);
                 break;
         case OPTION_NICE_COLOR:
-                err = parse_option_arg_string(arg, &config->common_config.bar->sections[2]->color);
+                err = gmbar_set_section_color(&config->common_config.bar->sections[2], arg);
                 break;
         case OPTION_IDLE_COLOR:
-                err = parse_option_arg_string(arg, &config->common_config.bar->sections[3]->color);
+                err = gmbar_set_section_color(&config->common_config.bar->sections[3], arg);
                 break;
         case OPTION_CPU_INDEX:
                 config->cpu_index = parse_unsigned_int(arg, NULL);
                 break;
+        case OPTION_BOOTSTRAP:
+                err = parse_option_arg_interval(arg, &config->bootstrap);
+                if (err)
+                {
+                        argp_error(state, "invalid interval: %s", arg);
+                }
+                break;
+        case OPTION_PLACEHOLDER:
+                config->placeholder = 1;
+                break;
 
         default:
                 err = ARGP_ERR_UNKNOWN;
@@ -226,122 +366,231 @@ handle_option(int key, char* arg, struct argp_state *state)
 }
 
 static int
-get_stat(buffer* stat,
-         const char* field,
-         unsigned int *kern,
-         unsigned int *user,
-         unsigned int *nice,
-         unsigned int *idle)
+get_stat(procfile* file,
+         buffer* stat,
+         cpu_table* table)
 {
+        stats_timer timer;
         int err = 0;
 
-        *kern = *user = *nice = *idle = 0;
-
-        /* reuse all the space */
-        stat->len = 0;
-
-        err = readfile("/proc/stat", &stat->buf, &stat->len, &stat->max);
+        stats_timer_start(&timer);
+        err = procfile_read(file, stat);
+        stats_timer_stop(&timer, STATS_READ);
         if (err)
         {
                 return err;
         }
 
-        err = parse_stat(stat->buf, stat->len, field, kern, user, nice, idle);
+        stats_timer_start(&timer);
+        err = parse_stat(stat->buf, stat->len, table);
+        stats_timer_stop(&timer, STATS_PARSE);
         return err;
 }
 
-
-static long
-get_num_cpus()
+/**
+ * Checks whether the system has a CPU with the given index.
+ *
+ * The CPU does not have to be online, as long as it is present in the
+ * system.  The list of present CPUs is read from sysfs (falling back to
+ * the list of online CPUs).  If neither can be read, the CPU lines in
+ * @table are used instead.
+ *
+ * @param   cpu     Index of the CPU
+ * @param   table   CPU counters from /proc/stat
+ * @return  Non-zero if the CPU exists, zero otherwise.
+ */
+static int
+cpu_exists(long cpu, const cpu_table* table)
 {
+        static const char* const lists[] = {
+                "/sys/devices/system/cpu/present",
+                "/sys/devices/system/cpu/online",
+        };
         int err = 0;
-        char* cpuinfo = NULL;
-        unsigned int size = 0;
-        unsigned int max = 0;
+        int exists = 0;
+        unsigned int i = 0;
+        buffer list = { NULL, 0, 0 };
 
-        err = readfile("/proc/cpuinfo", &cpuinfo, &size, &max);
-        if (err || !cpuinfo)
+        for (i = 0; i < sizeof(lists) / sizeof(lists[0]); i++)
         {
-                return err;
+                list.len = 0;
+                err = readfile(lists[i], &list.buf, &list.len, &list.max);
+                if (!err && list.len > 0)
+                {
+                        exists = parse_cpu_list(list.buf, list.len, cpu);
+                        free(list.buf);
+                        return exists;
+                }
         }
+        free(list.buf);
 
-        return parse_cpuinfo(cpuinfo, size);
+        return cpu + 1 < table->len && table->cpus[cpu + 1].present;
 }
 
 /**
+ * Checks whether a CPU is in a CPU list.
  *
+ * @param   list   CPU list in the sysfs format, e.g. "0-3,5,7-9\n"
+ * @param   size   Size of the list
+ * @param   cpu    Index of the CPU
+ * @return  Non-zero if the CPU is in the list, zero otherwise.
  */
-static long
-parse_cpuinfo(const char* cpuinfo, const unsigned int size)
+static int
+parse_cpu_list(const char* list, const unsigned int size, long cpu)
 {
-        const char* p = cpuinfo;
-        unsigned int len = size;
-        long cpus = 0;
+        const char* p = list;
+        const char* end = list + size;
+        long first = 0;
+        long last = 0;
 
-        do
+        while (p < end && isdigit(*p))
         {
-                p = memstr(p, "processor", len);
-                if (p && (p == cpuinfo || p[-1] == '\n'))
+                for (first = 0; p < end && isdigit(*p); p++)
+                        first = first * 10 + (*p - '0');
+                last = first;
+                if (p < end && *p == '-')
+                {
+                        for (p++, last = 0; p < end && isdigit(*p); p++)
+                                last = last * 10 + (*p - '0');
+                }
+                if (first <= cpu && cpu <= last)
+                {
+                        return 1;
+                }
+                if (p < end && *p == ',')
                 {
-                        cpus++;
-                        len = size - (p - cpuinfo);
                         p++;
                 }
-        } while (p);
+        }
 
-        return cpus;
+        return 0;
 }
 
 /**
- * Parse CPU field from stat.
+ * Parse all the CPU lines from stat.
+ *
+ * The CPU lines are at the beginning of /proc/stat, so parsing stops at
+ * the first line that is not a CPU line.  Slots of the CPUs that are not
+ * found (e.g. offline CPUs) are marked as not present.
  *
  * @param   stat      Contents of the /proc/stat file
  * @param   size      Size of the content
- * @param   field     Name of the field to parse, e.g. "cpu" or "cpu1", zero terminated
- * @param   kern      On return, contains the parsed value or zero.
- * @param   user      On return, contains the parsed value or zero.
- * @param   nice      On return, contains the parsed value or zero.
- * @param   idle      On return, contains the parsed value or zero.
- * @return  Zero on success, -1 if the field is not found.  Note that any
- * parse errors are not detected.
+ * @param   table     On return, contains the parsed counters.
+ * @return  Zero on success, -1 if the aggregate CPU line is not found or
+ *          memory allocation fails.  Note that any parse errors are not
+ *          detected.
  */
 static int
 parse_stat(const char* stat,
            const unsigned int size,
-           const char* field,
-           unsigned int *kern,
-           unsigned int *user,
-           unsigned int *nice,
-           unsigned int *idle)
+           cpu_table* table)
 {
         const char* p = stat;
-        unsigned int len = size;
+        const char* end = stat + size;
+        const char* eol = NULL;
+        unsigned int slot = 0;
+        unsigned int i = 0;
+        cpu_stat* cpu = NULL;
 
-        /* Initialize to zeros */
-        *kern = *user = *nice = *idle = 0;
+        for (i = 0; i < table->len; i++)
+        {
+                table->cpus[i].present = 0;
+        }
 
-        /* Find the field */
-        do
+        while (end - p > 3 && p[0] == 'c' && p[1] == 'p' && p[2] == 'u')
         {
-                p = memstr(p, field, len);
-                if (!p)
+                p += 3;
+
+                /* Aggregate line has no CPU index */
+                slot = isdigit(*p) ? parse_counter(&p, end) + 1 : 0;
+
+                if (slot >= table->len)
                 {
-                        log_error("Field not found: %d", -1);
-                        return -1;
+                        if (cpu_table_reserve(table, slot + 1))
+                        {
+                                return -1;
+                        }
+                        for (i = table->len; i <= slot; i++)
+                        {
+                                table->cpus[i].present = 0;
+                        }
+                        table->len = slot + 1;
                 }
-        } while (p != stat && p[-1] != '\n' && p++ && (len = size - (p - stat)));
 
-        /* Skip the label */
-        p += strlen(field);
+                cpu = &table->cpus[slot];
+                cpu->user = parse_counter(&p, end);
+                cpu->nice = parse_counter(&p, end);
+                cpu->kern = parse_counter(&p, end);
+                cpu->idle = parse_counter(&p, end);
+                cpu->present = 1;
 
-        *user = parse_unsigned_int(p, &p);
-        *nice = parse_unsigned_int(p, &p);
-        *kern = parse_unsigned_int(p, &p);
-        *idle = parse_unsigned_int(p, NULL);
+                /* Skip the rest of the line */
+                eol = memchr(p, '\n', end - p);
+                p = eol ? eol + 1 : end;
+        }
+
+        if (table->len == 0 || !table->cpus[0].present)
+        {
+                log_error("Field not found: %d", -1);
+                return -1;
+        }
 
         return 0;
 }
 
+/**
+ * Makes sure that there is room for at least @len slots in the table.
+ *
+ * @return  Zero on success, -1 if memory allocation failed.
+ */
+static int
+cpu_table_reserve(cpu_table* table, unsigned int len)
+{
+        unsigned int max = table->max ? table->max : 8;
+        cpu_stat* tmp = NULL;
+
+        if (len <= table->max)
+        {
+                return 0;
+        }
+
+        while (max < len)
+        {
+                max *= 2;
+        }
+
+        tmp = realloc(table->cpus, sizeof(cpu_stat) * max);
+        if (!tmp)
+        {
+                log_error("Error allocating space for CPU counters: %d", errno);
+                return -1;
+        }
+        table->cpus = tmp;
+        table->max = max;
+
+        return 0;
+}
+
+/**
+ * Parse a base ten value, skipping any leading non-digits on the same line.
+ *
+ * @param   str   String to parse, on return points past the parsed value
+ * @param   end   End of the content
+ * @return  Parsed value, or zero if there are no more values on the line.
+ */
+static unsigned int
+parse_counter(const char** str, const char* end)
+{
+        unsigned int value = 0;
+        const char* p = *str;
+        while (p < end && !isdigit(*p) && *p != '\n')
+                p++;
+        while (p < end && isdigit(*p))
+                value = value * 10 + (*p++ - '0');
+        *str = p;
+        return value;
+}
+
 /**
  * @param   str   String to parse
  * @return  Parsed value.
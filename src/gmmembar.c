@@ -1,40 +1,116 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
 
 #include "libgmbar.h"
 #include "common.h"
 #include "log.h"
-#include "readfile.h"
+#include "stats.h"
+#include "procfile.h"
 #include "buffer.h"
 #include "version.h"
 
+/* Maximum number of sections in the bar */
+#define MAX_SECTIONS 16
+
+/* Fields of /proc/meminfo known to gmmembar.  The "used" field is
+ * not in the file, it is computed as MemTotal - MemFree. */
+enum {
+        MEMINFO_USED = 0,
+        MEMINFO_MEM_TOTAL,
+        MEMINFO_MEM_FREE,
+        MEMINFO_MEM_AVAILABLE,
+        MEMINFO_BUFFERS,
+        MEMINFO_CACHED,
+        MEMINFO_SWAP_CACHED,
+        MEMINFO_ACTIVE,
+        MEMINFO_INACTIVE,
+        MEMINFO_SWAP_TOTAL,
+        MEMINFO_SWAP_FREE,
+        MEMINFO_DIRTY,
+        MEMINFO_WRITEBACK,
+        MEMINFO_ANON_PAGES,
+        MEMINFO_MAPPED,
+        MEMINFO_SHMEM,
+        MEMINFO_SLAB,
+        MEMINFO_SRECLAIMABLE,
+        MEMINFO_SUNRECLAIM,
+        MEMINFO_KERNEL_STACK,
+        MEMINFO_PAGE_TABLES,
+        MEMINFO_COMMITTED_AS,
+        MEMINFO_NFIELDS
+};
+
+/* Names of the fields, indexed by the field */
+static const char* const meminfo_fields[MEMINFO_NFIELDS] = {
+        "used",
+        "MemTotal",
+        "MemFree",
+        "MemAvailable",
+        "Buffers",
+        "Cached",
+        "SwapCached",
+        "Active",
+        "Inactive",
+        "SwapTotal",
+        "SwapFree",
+        "Dirty",
+        "Writeback",
+        "AnonPages",
+        "Mapped",
+        "Shmem",
+        "Slab",
+        "SReclaimable",
+        "SUnreclaim",
+        "KernelStack",
+        "PageTables",
+        "Committed_AS",
+};
+
+/* Default colors of the sections */
+static const char* const default_colors[] = {
+        "red", "orange", "yellow", "green", "cyan", "blue", "magenta", "white"
+};
+
+/* Values of the /proc/meminfo fields, in kB */
+typedef struct mem_stat mem_stat;
+struct mem_stat {
+        /** Bit mask of the fields that were found from the latest snapshot */
+        unsigned int present;
+        /** Field values, indexed by the field */
+        unsigned int values[MEMINFO_NFIELDS];
+};
+
 /* Static functions */
 static error_t handle_option(int key,
                              char* arg,
                              struct argp_state *state);
-static int get_meminfo(buffer* meminfo,
-                       unsigned int *total,
-                       unsigned int *used,
-                       unsigned int *buffers,
-                       unsigned int *cached);
+static int get_meminfo(procfile* file,
+                       buffer* meminfo,
+                       unsigned int wanted,
+                       mem_stat* mem);
 static int parse_meminfo(const char* meminfo,
                          const unsigned int size,
-                         unsigned int *total,
-                         unsigned int *used,
-                         unsigned int *buffers,
-                         unsigned int *cached);
-static int parse_meminfo_field(const char* meminfo,
-                               const unsigned int size,
-                               const char* field,
-                               unsigned int *value);
-static unsigned int parse_unsigned_int(const char* str);
+                         unsigned int wanted,
+                         mem_stat* mem);
+static int meminfo_field(const char* key,
+                         unsigned int len);
+static int parse_fields(const char* arg,
+                        unsigned int* nfields,
+                        int* fields,
+                        char** colors);
+static unsigned int fields_wanted(const int* fields,
+                                  unsigned int nfields);
+static int sample(void* data);
 
 /* Argp option keys (available: 'a'-'f') */
 enum {
         OPTION_USED_COLOR = 'a',
         OPTION_BUFFERS_COLOR = 'b',
         OPTION_CACHED_COLOR = 'c',
+        OPTION_FIELDS = 'd',
 };
 
 
@@ -42,6 +118,25 @@ enum {
 typedef struct arguments arguments;
 struct arguments {
         common_arguments common_config;
+        /** Number of sections */
+        unsigned int nfields;
+        /** Field shown in each section */
+        int fields[MAX_SECTIONS];
+        /** Color of each section, or NULL for the default */
+        char* colors[MAX_SECTIONS];
+        /** Color of the sections of each field, or NULL for the default.
+         *  Set by --used, --buffers and --cached. */
+        char* field_colors[MEMINFO_NFIELDS];
+        /** Fields to read from /proc/meminfo, one bit per field */
+        unsigned int wanted;
+};
+
+/* State kept between the samples */
+typedef struct sampler sampler;
+struct sampler {
+        arguments* config;
+        procfile* meminfofile;
+        buffer* meminfo;
 };
 
 /* Options */
@@ -52,6 +147,8 @@ static struct argp_option options[] = {
           "Color for the buffers portion of the bar"            },
         { "cached",     OPTION_CACHED_COLOR,       "COLOR",     0,
           "Color for the disk cache portion of the bar"         },
+        { "fields",     OPTION_FIELDS,             "FIELDS",    0,
+          "Comma separated list of FIELD[:COLOR] for the sections of the bar" },
         { 0 }
 };
 
@@ -65,76 +162,132 @@ int
 main(int argc, char** argv)
 {
         int err = 0;
-        unsigned int total, used, buffers, cached;
+        unsigned int i = 0;
+        const char* color = NULL;
         arguments config;
+        sampler state;
+        procfile* meminfofile = NULL;
         buffer* meminfo = NULL;
         gmbar* bar = NULL;
 
-        meminfo = buffer_new();
-        if (!meminfo)
+        meminfofile = procfile_new("/proc/meminfo");
+        if (!meminfofile)
         {
                 return -1;
         }
 
-        bar = gmbar_new_with_defaults(100, 10, "red", "none");
-        if (!bar)
+        meminfo = buffer_new();
+        if (!meminfo)
         {
-                buffer_free(meminfo);
+                procfile_free(meminfofile);
                 return -1;
         }
 
-        err = gmbar_add_sections(bar, 3, "red", "orange", "yellow");
-        if (err)
+        bar = gmbar_new_with_defaults(100, 10, "red", "none", MAX_SECTIONS);
+        if (!bar)
         {
                 buffer_free(meminfo);
-                gmbar_free(bar);
+                procfile_free(meminfofile);
                 return -1;
         }
 
-        config.common_config.bar = bar;
-        config.common_config.interval = 15;
-        config.common_config.prefix = NULL;
-        config.common_config.suffix = NULL;
-        err = argp_parse(&argp, argc, argv, 0, NULL, &config);
+        memset(config.colors, 0, sizeof(config.colors));
+        memset(config.field_colors, 0, sizeof(config.field_colors));
+        config.nfields = 3;
+        config.fields[0] = MEMINFO_USED;
+        config.fields[1] = MEMINFO_BUFFERS;
+        config.fields[2] = MEMINFO_CACHED;
+        common_arguments_init(&config.common_config, bar);
+        err = common_parse(&config.common_config, &argp, argc, argv, &config, 0);
         if (err)
         {
                 buffer_free(meminfo);
+                procfile_free(meminfofile);
+                common_arguments_free(&config.common_config);
                 gmbar_free(bar);
                 return err;
         }
 
-        do {
-                err = get_meminfo(meminfo, &total, &used, &buffers, &cached);
-                if (err)
+        for (i = 0; i < config.nfields; i++)
+        {
+                color = config.colors[i];
+                if (!color)
                 {
-                        buffer_free(meminfo);
-                        gmbar_free(bar);
-                        return err;
+                        color = default_colors[i % (sizeof(default_colors) / sizeof(default_colors[0]))];
                 }
-
-                gmbar_set_section_width(bar->sections[0], total, used);
-                gmbar_set_section_width(bar->sections[1], total, buffers);
-                gmbar_set_section_width(bar->sections[2], total, cached);
-
-                err = print_bar(&config.common_config);
+                err = gmbar_add_section(bar, color);
+                free(config.colors[i]);
+                config.colors[i] = NULL;
                 if (err)
                 {
                         buffer_free(meminfo);
+                        procfile_free(meminfofile);
+                        common_arguments_free(&config.common_config);
                         gmbar_free(bar);
-                        return err;
+                        return -1;
                 }
+        }
 
-                sleep(config.common_config.interval);
-        } while (config.common_config.interval);
+        state.config = &config;
+        state.meminfofile = meminfofile;
+        state.meminfo = meminfo;
+        err = sample(&state);
+        if (!err)
+        {
+                err = print_bar(&config.common_config);
+        }
+        if (!err)
+        {
+                err = common_run(&config.common_config, &argp, argc, argv, &config,
+                                 sample, &state);
+        }
 
-        return 0;
+        buffer_free(meminfo);
+        procfile_free(meminfofile);
+        common_arguments_free(&config.common_config);
+        gmbar_free(bar);
+        return err;
+}
+
+/**
+ * Reads /proc/meminfo and samples the memory usage.
+ *
+ * @param   data   The sampler
+ * @return  Zero on success, errno on failure.
+ */
+static int
+sample(void* data)
+{
+        sampler* state = (sampler*) data;
+        arguments* config = state->config;
+        unsigned int values[MAX_SECTIONS];
+        mem_stat mem;
+        unsigned int i = 0;
+        int err = 0;
+
+        err = get_meminfo(state->meminfofile, state->meminfo, config->wanted, &mem);
+        if (err)
+        {
+                return err;
+        }
+
+        for (i = 0; i < config->nfields; i++)
+        {
+                values[i] = mem.values[config->fields[i]];
+        }
+        return common_sample(&config->common_config, mem.values[MEMINFO_MEM_TOTAL], values);
 }
 
 static error_t
 handle_option(int key, char* arg, struct argp_state *state)
 {
         error_t err = 0;
+        unsigned int i = 0;
+        unsigned int nfields = 0;
+        int fields[MAX_SECTIONS];
+        char* colors[MAX_SECTIONS] = { NULL };
         arguments* config = (arguments*) state->input;
+        gmbar* bar = config->common_config.bar;
 
         switch (key)
         {
@@ -143,13 +296,79 @@ handle_option(int key, char* arg, struct argp_state *state)
                 break;
 
         case OPTION_USED_COLOR:
-                err = parse_option_arg_string(arg, &config->common_config.bar->sections[0]->color);
+                err = parse_option_arg_string(arg, &config->field_colors[MEMINFO_USED]);
                 break;
         case OPTION_BUFFERS_COLOR:
-                err = parse_option_arg_string(arg, &config->common_config.bar->sections[1]->color);
+                err = parse_option_arg_string(arg, &config->field_colors[MEMINFO_BUFFERS]);
                 break;
         case OPTION_CACHED_COLOR:
-                err = parse_option_arg_string(arg, &config->common_config.bar->sections[2]->color);
+                err = parse_option_arg_string(arg, &config->field_colors[MEMINFO_CACHED]);
+                break;
+        case OPTION_FIELDS:
+                err = parse_fields(arg, &nfields, fields, colors);
+                if (err)
+                {
+                        argp_error(state, "invalid field list: %s", arg);
+                }
+                else if (bar->nsections && nfields != bar->nsections)
+                {
+                        /* When the options are reloaded, the sections
+                         * exist already, so the fields can change but
+                         * their number can not */
+                        log_warning("Number of fields can not change on reload: %u", nfields);
+                }
+                else
+                {
+                        config->nfields = nfields;
+                        memcpy(config->fields, fields, nfields * sizeof(int));
+                        for (i = 0; i < nfields; i++)
+                        {
+                                if (colors[i])
+                                {
+                                        free(config->colors[i]);
+                                        config->colors[i] = colors[i];
+                                        colors[i] = NULL;
+                                }
+                        }
+                }
+                for (i = 0; i < MAX_SECTIONS; i++)
+                {
+                        free(colors[i]);
+                }
+                break;
+
+        case ARGP_KEY_SUCCESS:
+                config->wanted = fields_wanted(config->fields, config->nfields);
+                /* The color options apply to the sections of their
+                 * field, wherever --fields put them, unless --fields
+                 * gave the section a color */
+                for (i = 0; i < config->nfields && !err; i++)
+                {
+                        if (!config->colors[i] && config->field_colors[config->fields[i]])
+                        {
+                                err = parse_option_arg_string(config->field_colors[config->fields[i]],
+                                                              &config->colors[i]);
+                        }
+                }
+                /* When the options are reloaded, the sections exist
+                 * already and only their colors are updated */
+                for (i = 0; i < bar->nsections; i++)
+                {
+                        if (!err && config->colors[i])
+                        {
+                                err = gmbar_set_section_color(&bar->sections[i], config->colors[i]);
+                        }
+                        free(config->colors[i]);
+                        config->colors[i] = NULL;
+                }
+                break;
+
+        case ARGP_KEY_FINI:
+                for (i = 0; i < MEMINFO_NFIELDS; i++)
+                {
+                        free(config->field_colors[i]);
+                        config->field_colors[i] = NULL;
+                }
                 break;
 
         default:
@@ -161,129 +380,273 @@ handle_option(int key, char* arg, struct argp_state *state)
 }
 
 static int
-get_meminfo(buffer* meminfo,
-            unsigned int *total,
-            unsigned int *used,
-            unsigned int *buffers,
-            unsigned int *cached)
+get_meminfo(procfile* file,
+            buffer* meminfo,
+            unsigned int wanted,
+            mem_stat* mem)
 {
+        stats_timer timer;
         int err = 0;
 
-        *total = *used = *buffers = *cached = 0;
-
-        /* reuse all the space */
-        meminfo->len = 0;
-
-        err = readfile("/proc/meminfo", &meminfo->buf, &meminfo->len, &meminfo->max);
+        stats_timer_start(&timer);
+        err = procfile_read(file, meminfo);
+        stats_timer_stop(&timer, STATS_READ);
         if (err)
         {
                 return err;
         }
 
-        err = parse_meminfo(meminfo->buf, meminfo->len, total, used, buffers, cached);
+        stats_timer_start(&timer);
+        err = parse_meminfo(meminfo->buf, meminfo->len, wanted, mem);
+        stats_timer_stop(&timer, STATS_PARSE);
         return err;
 }
 
-
+/**
+ * Parse meminfo in one pass.
+ *
+ * Every line is looked up from the known fields by its label, so the
+ * cost does not depend on how many fields are wanted.  Parsing stops as
+ * soon as all the wanted fields are found.
+ *
+ * @param   meminfo   Contents of the /proc/meminfo file
+ * @param   size      Content length in bytes
+ * @param   wanted    Bit mask of the fields that must be found
+ * @param   mem       On return, contains the parsed values.  Values of the
+ *                    fields that are not found are zero.
+ * @return  Zero on success, -1 if any of the wanted fields is not found.
+ * Note that any parse errors are not detected.
+ */
 static int
 parse_meminfo(const char* meminfo,
               const unsigned int size,
-              unsigned int *total,
-              unsigned int *used,
-              unsigned int *buffers,
-              unsigned int *cached)
+              unsigned int wanted,
+              mem_stat* mem)
 {
-        int err = 0;
-        unsigned int free;
+        const char* p = meminfo;
+        const char* end = meminfo + size;
+        const char* colon = NULL;
+        const char* eol = NULL;
+        unsigned int value = 0;
+        unsigned int missing = 0;
+        int field = 0;
 
-        err = parse_meminfo_field(meminfo, size, "MemTotal", total);
-        if (err)
+        memset(mem, 0, sizeof(mem_stat));
+
+        while (p < end && (mem->present & wanted) != wanted)
         {
-                log_error("Error parsing MemTotal: %d", err);
-                return err;
+                eol = memchr(p, '\n', end - p);
+                if (!eol)
+                {
+                        eol = end;
+                }
+
+                colon = memchr(p, ':', eol - p);
+                if (colon)
+                {
+                        field = meminfo_field(p, colon - p);
+                        if (field >= 0)
+                        {
+                                /* Skip non-digits like colons and spaces */
+                                for (p = colon; p < eol && !isdigit(*p); p++)
+                                        ;
+                                /* Parse the digits (base ten value) */
+                                for (value = 0; p < eol && isdigit(*p); p++)
+                                        value = value * 10 + (*p - '0');
+
+                                mem->values[field] = value;
+                                mem->present |= 1 << field;
+                        }
+                }
+
+                p = eol + 1;
         }
 
-        err = parse_meminfo_field(meminfo, size, "MemFree", &free);
-        if (err)
+        missing = wanted & ~mem->present;
+        if (missing)
         {
-                log_error("Error parsing MemFree: %d", err);
-                return err;
+                for (field = 0; !(missing & (1 << field)); field++)
+                        ;
+                log_error("Error parsing %s: %d", meminfo_fields[field], -1);
+                return -1;
         }
 
-        err = parse_meminfo_field(meminfo, size, "Buffers", buffers);
-        if (err)
+        if (mem->present & (1 << MEMINFO_MEM_FREE))
         {
-                log_error("Error parsing Buffers: %d", err);
-                return err;
+                mem->values[MEMINFO_USED] = mem->values[MEMINFO_MEM_TOTAL]
+                        - mem->values[MEMINFO_MEM_FREE];
         }
 
-        err = parse_meminfo_field(meminfo, size, "Cached", cached);
-        if (err)
+        return 0;
+}
+
+/**
+ * Look up a meminfo field by its label.
+ *
+ * @param   key   Label of the field, not zero terminated
+ * @param   len   Length of the label
+ * @return  The field, or -1 if the field is not known.
+ */
+static int
+meminfo_field(const char* key, unsigned int len)
+{
+        int field = -1;
+
+        switch (len)
         {
-                log_error("Error parsing Cached: %d", err);
-                return err;
+        case 4:
+                field = MEMINFO_SLAB;
+                break;
+        case 5:
+                field = key[0] == 'D' ? MEMINFO_DIRTY : MEMINFO_SHMEM;
+                break;
+        case 6:
+                field = key[0] == 'A' ? MEMINFO_ACTIVE
+                      : key[0] == 'C' ? MEMINFO_CACHED
+                      : MEMINFO_MAPPED;
+                break;
+        case 7:
+                field = key[0] == 'B' ? MEMINFO_BUFFERS : MEMINFO_MEM_FREE;
+                break;
+        case 8:
+                field = key[0] == 'I' ? MEMINFO_INACTIVE
+                      : key[1] == 'e' ? MEMINFO_MEM_TOTAL
+                      : MEMINFO_SWAP_FREE;
+                break;
+        case 9:
+                field = key[0] == 'A' ? MEMINFO_ANON_PAGES
+                      : key[0] == 'W' ? MEMINFO_WRITEBACK
+                      : MEMINFO_SWAP_TOTAL;
+                break;
+        case 10:
+                field = key[0] == 'P' ? MEMINFO_PAGE_TABLES
+                      : key[1] == 'w' ? MEMINFO_SWAP_CACHED
+                      : MEMINFO_SUNRECLAIM;
+                break;
+        case 11:
+                field = MEMINFO_KERNEL_STACK;
+                break;
+        case 12:
+                field = key[0] == 'C' ? MEMINFO_COMMITTED_AS
+                      : key[0] == 'M' ? MEMINFO_MEM_AVAILABLE
+                      : MEMINFO_SRECLAIMABLE;
+                break;
         }
 
-        *used = *total - free;
+        /* The guess above is based on the length and a character or two,
+         * so it has to be verified */
+        if (field >= 0 && memcmp(key, meminfo_fields[field], len))
+        {
+                field = -1;
+        }
 
-        return err;
+        return field;
 }
 
 /**
- * Parse one field of meminfo.
+ * Parse the argument of --fields.
  *
- * @param   meminfo   Contents of the /proc/meminfo file
- * @param   size      Content length in bytes
- * @param   field     Name of the field to parse, e.g. "MemTotal", zero terminated
- * @param   value     On return, contains the parsed value or zero.
- * @return  Zero on success, -1 if the field is not found.  Note that any
- * parse errors are not detected.
+ * The argument is not modified, as it is parsed again when the options
+ * are reloaded.
+ *
+ * @param   arg       Comma separated list of FIELD[:COLOR]
+ * @param   nfields   On return, the number of fields
+ * @param   fields    On return, the fields
+ * @param   colors    On return, the colors, or NULL for default color
+ * @return  Zero on success, EINVAL if the list is invalid, and ENOMEM if
+ *          memory allocation failed.
  */
 static int
-parse_meminfo_field(const char* meminfo,
-                    const unsigned int size,
-                    const char* field,
-                    unsigned int *value)
+parse_fields(const char* arg, unsigned int* nfields, int* fields, char** colors)
 {
-        const char* p = meminfo;
-        unsigned int len = size;
-
-        /* Initialize to zero */
-        *value = 0;
+        int err = 0;
+        unsigned int n = 0;
+        int field = 0;
+        char* copy = NULL;
+        char* saveptr = NULL;
+        char* item = NULL;
+        char* color = NULL;
+
+        copy = strdup(arg);
+        if (!copy)
+        {
+                return ENOMEM;
+        }
 
-        /* Find the field */
-        do
+        for (item = strtok_r(copy, ",", &saveptr);
+             item && !err;
+             item = strtok_r(NULL, ",", &saveptr), n++)
         {
-                p = memstr(p, field, len);
-                if (!p)
+                if (n == MAX_SECTIONS)
                 {
-                        return -1;
+                        err = EINVAL;
+                        break;
                 }
-        } while (p != meminfo && p[-1] != '\n' && p++ && len--);
 
-        /* Skip the label */
-        p += strlen(field);
+                color = strchr(item, ':');
+                if (color)
+                {
+                        *color++ = '\0';
+                }
 
-        /* Skip non-digits like colons and spaces */
-        while (!isdigit(*p))
-                p++;
+                for (field = 0; field < MEMINFO_NFIELDS; field++)
+                {
+                        if (strcasecmp(item, meminfo_fields[field]) == 0)
+                        {
+                                break;
+                        }
+                }
+                if (field == MEMINFO_NFIELDS)
+                {
+                        err = EINVAL;
+                        break;
+                }
+                fields[n] = field;
 
-        /* Parse the digits (base ten value) */
-        *value = parse_unsigned_int(p);
+                if (color)
+                {
+                        err = parse_option_arg_string(color, &colors[n]);
+                }
+        }
 
-        return 0;
+        if (!err && n == 0)
+        {
+                err = EINVAL;
+        }
+        if (!err)
+        {
+                *nfields = n;
+        }
+
+        free(copy);
+        return err;
 }
 
 /**
- * @param   str   String to parse
- * @return  Parsed value.
+ * Finds out which /proc/meminfo fields are needed for the sections.
+ *
+ * @param   fields    Fields of the sections
+ * @param   nfields   Number of sections
+ * @return  Bit mask of the fields to read.
  */
 static unsigned int
-parse_unsigned_int(const char* str)
+fields_wanted(const int* fields, unsigned int nfields)
 {
-        unsigned int value = 0;
-        const char *p = str;
-        while(isdigit(*p))
-                value = value * 10 + (*p++ - '0');
-        return value;
+        /* Total is always needed */
+        unsigned int wanted = 1 << MEMINFO_MEM_TOTAL;
+        unsigned int i = 0;
+
+        for (i = 0; i < nfields; i++)
+        {
+                if (fields[i] == MEMINFO_USED)
+                {
+                        wanted |= 1 << MEMINFO_MEM_FREE;
+                }
+                else
+                {
+                        wanted |= 1 << fields[i];
+                }
+        }
+
+        return wanted;
 }
@@ -4,6 +4,100 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
+
+/**
+ * Renderer output.
+ *
+ * If @buf is NULL, nothing is written and only the length is counted.
+ *
+ * To keep the output small, cursor movements and section rectangles are
+ * not written immediately.  Consecutive movements are merged into one
+ * ^p(), consecutive rectangles of the same color into one ^r(), and a
+ * ^fg() that would not change the color is dropped.
+ */
+typedef struct gmoutput gmoutput;
+struct gmoutput {
+        /** Output buffer, or NULL */
+        char* buf;
+        /** Number of bytes written (or counted) so far */
+        int len;
+        /** Size of the output buffer */
+        int max;
+        /** Pending cursor movement */
+        int move;
+        /** Width of the pending section rectangle, zero if none */
+        unsigned int rect;
+        /** Color id of the current color, -1 if none */
+        int color;
+};
+
+/* Generation of the last compiled plan */
+static unsigned int gmbar_generation = 0;
+
+static int           gmbar_reserve_sections(gmbar* bar,
+                                            unsigned int nsections);
+static int           gmbar_arena_reserve   (gmbar* bar,
+                                            unsigned int len,
+                                            char** old);
+static char*         gmbar_arena_strdup    (gmbar* bar,
+                                            const char* str);
+static char*         gmbar_arena_move      (gmbar* bar,
+                                            const char* str);
+static void          gmbar_emit_str        (gmoutput* out,
+                                            const char* str,
+                                            unsigned int len);
+static void          gmbar_emit_uint       (gmoutput* out,
+                                            unsigned int value);
+static void          gmbar_emit_int        (gmoutput* out,
+                                            int value);
+static void          gmbar_emit_fg         (gmoutput* out,
+                                            const char* color);
+static void          gmbar_emit_rect       (gmoutput* out,
+                                            const char* token,
+                                            unsigned int len,
+                                            unsigned int width,
+                                            unsigned int height);
+static void          gmbar_emit_move       (gmoutput* out,
+                                            int width);
+static void          gmbar_emit_section    (gmoutput* out,
+                                            const gmplan* plan,
+                                            unsigned int width);
+static void          gmbar_out_move        (gmoutput* out,
+                                            const gmplan* plan,
+                                            int width);
+static void          gmbar_out_rect        (gmoutput* out,
+                                            const gmplan* plan,
+                                            unsigned int width);
+static void          gmbar_out_color       (gmoutput* out,
+                                            const gmplan* plan,
+                                            const gmsection* section);
+static void          gmbar_out_flush       (gmoutput* out,
+                                            const gmplan* plan);
+static unsigned int  gmbar_out_segments    (gmoutput* out,
+                                            const gmbar* bar,
+                                            unsigned int phase,
+                                            unsigned int width);
+static unsigned int  gmbar_cache_hash      (const gmbar* bar);
+static gmframe*      gmbar_cache_lookup    (gmcache* cache,
+                                            const gmbar* bar,
+                                            unsigned int hash);
+static void          gmbar_cache_store     (gmcache* cache,
+                                            const gmbar* bar,
+                                            unsigned int hash,
+                                            const char* text,
+                                            unsigned int len);
+static void          gmbar_cache_evict     (gmcache* cache);
+static void          gmbar_cache_clear     (gmcache* cache);
+static int           gmbar_reserve         (char** buf,
+                                            int len,
+                                            int* max,
+                                            int size);
+static int           gmbar_compile         (gmbar* bar);
+static void          gmbar_compile_text    (gmbar* bar,
+                                            gmoutput* out);
+static void          gmbar_render          (const gmbar* bar,
+                                            gmoutput* out);
 
 /**
  * Creates a new gmbar.
@@ -25,28 +119,35 @@ gmbar_new()
 /**
  * Creates a new gmbar.
  *
- * @param   width    Width
- * @param   height   Height
- * @param   fg       Foreground color
- * @param   bg       Background color
+ * @param   width       Width
+ * @param   height      Height
+ * @param   fg          Foreground color, or NULL for "none"
+ * @param   bg          Background color, or NULL for "none"
+ * @param   nsections   Number of sections to reserve room for
  * @return  A newly allocated gmbar or NULL if there was not enought memory
  *          to allocate one.
  */
 gmbar*
-gmbar_new_with_defaults(unsigned int width, unsigned int height, char* fg, char* bg)
+gmbar_new_with_defaults(unsigned int width, unsigned int height,
+                        const char* fg, const char* bg, unsigned int nsections)
 {
         gmbar* bar = gmbar_new();
+        char* old = NULL;
+        fg = fg ? fg : "none";
+        bg = bg ? bg : "none";
         if (bar)
         {
                 bar->size.width  = width;
                 bar->size.height = height;
-                bar->color.fg = strdup(fg ? fg : "none");
-                bar->color.bg = strdup(bg ? bg : "none");
-                if (!bar->color.fg || !bar->color.bg)
+                /* room for the colors, assuming "#rrggbb" for sections */
+                if (gmbar_reserve_sections(bar, nsections)
+                    || gmbar_arena_reserve(bar, strlen(fg) + strlen(bg) + 2 + nsections * 8, &old))
                 {
                         gmbar_free(bar);
-                        bar = NULL;
+                        return NULL;
                 }
+                bar->color.fg = gmbar_arena_strdup(bar, fg);
+                bar->color.bg = gmbar_arena_strdup(bar, bg);
         }
         return bar;
 }
@@ -57,74 +158,162 @@ gmbar_new_with_defaults(unsigned int width, unsigned int height, char* fg, char*
 void
 gmbar_free(gmbar* bar)
 {
-        int i = 0;
         if (bar)
         {
-                for (i = bar->nsections - 1; i >= 0; i--)
-                {
-                        gmsection* section = bar->sections[i];
-                        if (section)
-                        {
-                                if (section->color)
-                                {
-                                        free(section->color);
-                                }
-                                free(section);
-                        }
-                }
                 if (bar->sections)
                 {
                         free(bar->sections);
                 }
-                if (bar->color.fg)
+                if (bar->arena)
                 {
-                        free(bar->color.fg);
+                        free(bar->arena);
                 }
-                if (bar->color.bg)
+                if (bar->plan.text)
                 {
-                        free(bar->color.bg);
+                        free(bar->plan.text);
                 }
                 free(bar);
         }
 }
 
 /**
- * Adds a new section to the bar.
+ * Makes sure there is room for @nsections sections in total.
  *
- * On successful execution, takes ownership of the @color pointer.
- *
- * @param   color   Color of the section.
- * @return  Zero on success, non-zero on failure.
+ * @return  Zero on success, ENOMEM if memory allocation failed.
  */
-int
-gmbar_add_section(gmbar* bar, char* color)
+static int
+gmbar_reserve_sections(gmbar* bar, unsigned int nsections)
 {
-        gmsection* section = (gmsection*) malloc(sizeof(gmsection));
-        if (section)
+        gmsection* sections = NULL;
+        if (nsections > bar->max_sections)
         {
-                gmsection** sections = (gmsection**) malloc(sizeof(gmsection*) * (bar->nsections + 1));
-                if (sections)
+                sections = (gmsection*) realloc(bar->sections, sizeof(gmsection) * nsections);
+                if (!sections)
                 {
-                        if (bar->sections)
-                        {
-                                memcpy(sections, bar->sections, sizeof(gmsection*) * bar->nsections);
-                                free(bar->sections);
-                        }
-                        bar->sections = sections;
-                        bar->sections[bar->nsections] = section;
-                        section->bar   = bar;
-                        section->width = 0;
-                        section->color = color;
-                        bar->nsections++;
-                }
-                else
-                {
-                        free(section);
-                        section = NULL;
+                        return ENOMEM;
                 }
+                bar->sections = sections;
+                bar->max_sections = nsections;
+        }
+        return 0;
+}
+
+/**
+ * Makes sure there is room for @len more bytes in the color arena.
+ *
+ * When the arena is full, the colors in use are moved to a new arena
+ * (leaving behind the colors that have been replaced), and the color
+ * pointers of the bar and its sections are updated.
+ *
+ * The old arena is not freed, as the colors about to be copied to the
+ * arena may be in it, e.g. when a section is given the color it has.
+ * The caller frees it once they are copied.
+ *
+ * @param   old   On return, the old arena to free, or NULL
+ * @return  Zero on success, ENOMEM if memory allocation failed.
+ */
+static int
+gmbar_arena_reserve(gmbar* bar, unsigned int len, char** old)
+{
+        unsigned int i = 0;
+
+        *old = NULL;
+        if (bar->arena_len + len <= bar->arena_max)
+        {
+                return 0;
+        }
+
+        /* size the new arena for twice the colors in use */
+        len += bar->color.fg ? strlen(bar->color.fg) + 1 : 0;
+        len += bar->color.bg ? strlen(bar->color.bg) + 1 : 0;
+        for (i = 0; i < bar->nsections; i++)
+        {
+                len += strlen(bar->sections[i].color) + 1;
+        }
+        *old = bar->arena;
+        bar->arena = (char*) malloc(len * 2);
+        if (!bar->arena)
+        {
+                bar->arena = *old;
+                *old = NULL;
+                return ENOMEM;
+        }
+        bar->arena_len = 0;
+        bar->arena_max = len * 2;
+
+        bar->color.fg = gmbar_arena_move(bar, bar->color.fg);
+        bar->color.bg = gmbar_arena_move(bar, bar->color.bg);
+        for (i = 0; i < bar->nsections; i++)
+        {
+                bar->sections[i].color = gmbar_arena_move(bar, bar->sections[i].color);
+        }
+        return 0;
+}
+
+/**
+ * Copies @str to the arena.  There must be room for it.
+ *
+ * @return  The copy.
+ */
+static char*
+gmbar_arena_strdup(gmbar* bar, const char* str)
+{
+        char* copy = bar->arena + bar->arena_len;
+        unsigned int len = strlen(str) + 1;
+        memcpy(copy, str, len);
+        bar->arena_len += len;
+        return copy;
+}
+
+/**
+ * Copies @str, if not NULL, to the arena.  There must be room for it.
+ *
+ * @return  The copy, or NULL.
+ */
+static char*
+gmbar_arena_move(gmbar* bar, const char* str)
+{
+        return str ? gmbar_arena_strdup(bar, str) : NULL;
+}
+
+/**
+ * Adds a new section to the bar.
+ *
+ * @param   color   Color of the section, copied
+ * @return  Zero on success, ENOMEM if memory allocation failed.
+ */
+int
+gmbar_add_section(gmbar* bar, const char* color)
+{
+        gmsection* section = NULL;
+        char* old = NULL;
+        int err = 0;
+
+        if (bar->nsections == bar->max_sections)
+        {
+                err = gmbar_reserve_sections(bar, bar->max_sections ? bar->max_sections * 2 : 4);
+        }
+        if (!err)
+        {
+                err = gmbar_arena_reserve(bar, strlen(color) + 1, &old);
+        }
+        if (err)
+        {
+                return err;
         }
 
-        return section ? 0 : -1;
+        section = &bar->sections[bar->nsections];
+        section->bar   = bar;
+        section->width = 0;
+        section->color = gmbar_arena_strdup(bar, color);
+        free(old);
+        section->token = 0;
+        section->token_len = 0;
+        section->color_id = 0;
+        bar->nsections++;
+        bar->plan.valid = 0;
+
+        return 0;
 }
 
 /**
@@ -139,23 +328,13 @@ gmbar_add_sections(gmbar* bar, unsigned int nsections, ...)
 {
         int err = 0;
         unsigned int i = 0;
-        char* color = NULL;
         va_list argv;
+
+        err = gmbar_reserve_sections(bar, bar->nsections + nsections);
         va_start(argv, nsections);
-        for ( ; i < nsections; i++ )
+        for ( ; !err && i < nsections; i++ )
         {
-                color = va_arg(argv, char*);
-                color = strdup(color);
-                if (!color)
-                {
-                        err = -1;
-                        break;
-                }
-                err = gmbar_add_section(bar, color);
-                if (err)
-                {
-                        break;
-                }
+                err = gmbar_add_section(bar, va_arg(argv, const char*));
         }
         va_end(argv);
         return err;
@@ -191,188 +370,1130 @@ gmbar_set_section_width(gmsection* section, unsigned int total, unsigned int val
 }
 
 /**
+ * Sets the widths of all the sections given their values.
  *
+ * Each section gets the largest multiple of granularity (or of one pixel)
+ * that fits its share of the inner width.  The units left over, after
+ * the sum of the values is rounded, go to the sections with the largest
+ * remainders.  So if the values add up to @total, the sections exactly
+ * fill the inner width (give or take granularity), and no section is off
+ * by more than one unit.
  *
- * @param   bar   Bar to textualize
- * @param   nl    If non-zero, newline is added to the end of the string
- * @param   data  On return, a newly allocated buffer or NULL if
- *                allocation failed.  Caller is responsible for freeing
- *                the returned buffer.
- * @return  Zero on success, non-zero on failure.
+ * If the values add up to more than @total, the sections that do not fit
+ * in the inner width are cut short.
+ *
+ * @param   total    Total value
+ * @param   values   Values, one per section
  */
-int
-gmbar_format(gmbar* bar, unsigned int nl, char** buf, int* len, int* max)
+void
+gmbar_set_section_widths(gmbar* bar, unsigned int total, const unsigned int* values)
 {
-        const int orig_len = *len;
-        int err = 0;
-        char* tmp = NULL;
-        /* width of the bar without margins */
-        int bar_width = bar->size.width - bar->margin.left - bar->margin.right;
-        /* height of the sections */
-        unsigned int section_height = bar->size.height
-                - bar->margin.top - bar->margin.bottom
-                - bar->padding.top - bar->padding.bottom;
-        /* number of pixels from the start of the first section to the
-         * right margin */
-        int width = bar_width - bar->padding.left + bar->margin.right;
-        int current_segment_width = 0;
-        int current_gap_width = 0;
-
+        int inner_width = bar->size.width
+                - bar->margin.left - bar->margin.right
+                - bar->padding.left - bar->padding.right;
+        unsigned long long unit = bar->granularity > 0 ? bar->granularity : 1;
+        unsigned long long sum = 0;
+        unsigned long long den = 0;
+        unsigned long long units = 0;
+        unsigned long long width = 0;
+        unsigned long long rem = 0;
+        unsigned long long best_rem = 0;
+        unsigned long long prev_rem = 0;
+        unsigned int best = 0;
+        unsigned int prev = 0;
         unsigned int i = 0;
-        gmsection* section = NULL;
 
-        do
+        if (inner_width < 0)
         {
-                if (*len >= *max)
+                inner_width = 0;
+        }
+        for (i = 0; i < bar->nsections; i++)
+        {
+                sum += values[i];
+        }
+        /* value * inner_width / den is the width of a section in units */
+        den = total * unit;
+        if (den == 0)
+        {
+                for (i = 0; i < bar->nsections; i++)
                 {
-                        tmp = realloc(*buf, *max + 1024);
-                        if (!tmp)
-                        {
-                                err = errno;
-                                break;
-                        }
-                        *max += 1024;
-                        *buf = tmp;
-                        *len = orig_len;
+                        bar->sections[i].width = 0;
                 }
+                return;
+        }
 
-                /* draw the background, if not none */
-                if ( *max - *len > 0 && strcmp(bar->color.bg, "none") )
-                {
-                        *len += snprintf(*buf + *len, *max - *len, "^fg(%s)^r(%ux%u)^p(%d)",
-                                         bar->color.bg,
-                                         bar->size.width,
-                                         bar->size.height,
-                                         -bar->size.width);
-                }
+        /* number of units to hand out */
+        units = sum * inner_width;
+        if (bar->granularity > 0)
+        {
+                units += ((unsigned long long) bar->rounding_fp * total) >> 16;
+        }
+        units /= den;
+        if (units > inner_width / unit)
+        {
+                units = inner_width / unit;
+        }
 
-                /* ignore background for the rest of the drawing */
-                if ( *max - *len > 0 )
+        /* whole units first */
+        for (i = 0; i < bar->nsections; i++)
+        {
+                width = values[i] * (unsigned long long) inner_width / den;
+                if (width > units)
                 {
-                        *len += snprintf(*buf + *len, *max - *len, "^ib(1)");
+                        width = units;
                 }
+                bar->sections[i].width = width * unit;
+                units -= width;
+        }
 
-                /* leave margin */
-                if ( *max - *len > 0 && bar->margin.left )
+        /* hand the rest out in the order of the remainders, largest
+         * first, ties going to the first sections */
+        prev_rem = den;
+        while (units--)
+        {
+                best = bar->nsections;
+                for (i = 0; i < bar->nsections; i++)
                 {
-                        *len += snprintf(*buf + *len, *max - *len, "^p(%d)",
-                                         bar->margin.left);
+                        rem = values[i] * (unsigned long long) inner_width % den;
+                        if ((rem < prev_rem || (rem == prev_rem && i > prev))
+                            && (best == bar->nsections || rem > best_rem))
+                        {
+                                best = i;
+                                best_rem = rem;
+                        }
                 }
-
-                /* draw the outline, if color is not none */
-                if ( *max - *len > 0 && strcmp(bar->color.fg, "none") )
+                if (best == bar->nsections)
                 {
-                        *len += snprintf(*buf + *len, *max - *len, "^fg(%s)^ro(%ux%u)^p(%d)",
-                                         bar->color.fg,
-                                         bar_width,
-                                         bar->size.height - bar->margin.top - bar->margin.bottom,
-                                         -bar_width);
+                        break;
                 }
+                bar->sections[best].width += unit;
+                prev = best;
+                prev_rem = best_rem;
+        }
+}
 
-                /* leave padding */
-                if ( *max - *len > 0 && bar->padding.left )
-                {
-                        *len += snprintf(*buf + *len, *max - *len, "^p(%d)",
-                                         bar->padding.left);
-                }
+/**
+ * Sets a section color.
+ *
+ * @param   color   Color of the section, copied
+ * @return  Zero on success, ENOMEM if memory allocation failed.
+ */
+int
+gmbar_set_section_color(gmsection* section, const char* color)
+{
+        gmbar* bar = (gmbar*)section->bar;
+        char* old = NULL;
+        if (gmbar_arena_reserve(bar, strlen(color) + 1, &old))
+        {
+                return ENOMEM;
+        }
+        section->color = gmbar_arena_strdup(bar, color);
+        free(old);
+        gmbar_invalidate(bar);
+        return 0;
+}
+
+/**
+ * Sets the bar size, including margins.
+ */
+void
+gmbar_set_size(gmbar* bar, unsigned int width, unsigned int height)
+{
+        bar->size.width = width;
+        bar->size.height = height;
+        gmbar_invalidate(bar);
+}
+
+/**
+ * Sets the bar margins.
+ */
+void
+gmbar_set_margin(gmbar* bar, gmmargin margin)
+{
+        bar->margin = margin;
+        gmbar_invalidate(bar);
+}
+
+/**
+ * Sets the bar paddings.
+ */
+void
+gmbar_set_padding(gmbar* bar, gmmargin padding)
+{
+        bar->padding = padding;
+        gmbar_invalidate(bar);
+}
+
+/**
+ * Sets the bar colors.
+ *
+ * @param   fg   Foreground (outline) color, copied, or NULL to keep the
+ *               current color
+ * @param   bg   Background color, copied, or NULL to keep the current
+ *               color
+ * @return  Zero on success, ENOMEM if memory allocation failed.
+ */
+int
+gmbar_set_color(gmbar* bar, const char* fg, const char* bg)
+{
+        char* old = NULL;
+        if (gmbar_arena_reserve(bar, (fg ? strlen(fg) + 1 : 0) + (bg ? strlen(bg) + 1 : 0), &old))
+        {
+                return ENOMEM;
+        }
+        if (fg)
+        {
+                bar->color.fg = gmbar_arena_strdup(bar, fg);
+        }
+        if (bg)
+        {
+                bar->color.bg = gmbar_arena_strdup(bar, bg);
+        }
+        free(old);
+        gmbar_invalidate(bar);
+        return 0;
+}
+
+/**
+ * Sets the segment and gap widths.
+ */
+void
+gmbar_set_segments(gmbar* bar, unsigned int width, unsigned int gap)
+{
+        bar->segment_width = width;
+        bar->segment_gap = gap;
+        gmbar_invalidate(bar);
+}
+
+/**
+ * Sets the section width granularity and rounding.
+ */
+void
+gmbar_set_granularity(gmbar* bar, unsigned int granularity, double rounding)
+{
+        bar->granularity = granularity;
+        bar->rounding = rounding;
+        bar->rounding_fp = rounding > 0 ? (unsigned int) (rounding * 65536) : granularity * 32768;
+        gmbar_invalidate(bar);
+}
+
+/**
+ * Marks the rendering plan out of date.
+ *
+ * The gmbar_set_*() functions call this automatically.  Call this after
+ * modifying the bar fields directly.
+ */
+void
+gmbar_invalidate(gmbar* bar)
+{
+        bar->plan.valid = 0;
+}
+
+/**
+ * Computes the length of the textual bar.
+ *
+ * @param   bar   Bar to textualize
+ * @return  Exact number of bytes gmbar_format() would write, excluding
+ *          the terminating zero, or negative errno on failure.
+ */
+int
+gmbar_format_size(gmbar* bar)
+{
+        gmoutput out = { NULL, 0, 0, 0, 0, -1 };
+        int err = 0;
 
-                /* draw the sections */
-                for (i = 0, section = NULL, current_segment_width = bar->segment_width, current_gap_width = bar->segment_gap;
-                     i < bar->nsections && (section = bar->sections[i]) && *max - *len > 0;
-                     i++, width -= section->width)
+        if (!bar->plan.valid)
+        {
+                err = gmbar_compile(bar);
+                if (err)
                 {
-                        if (section->width == 0)
-                        {
-                                // nothing to do
-                        }
-                        else if (strcmp(section->color, "none") == 0)
-                        {
-                                *len += snprintf(*buf + *len, *max - *len, "^p(%u)", section->width);
-                        }
-                        else
-                        {
-                                if (bar->segment_width == 0 || bar->segment_gap == 0)
-                                {
-                                        *len += snprintf(*buf + *len, *max - *len, "^fg(%s)^r(%ux%u)",
-                                                         section->color,
-                                                         section->width,
-                                                         section_height);
-                                }
-                                else
-                                {
-                                        int section_width = section->width;
-                                        *len += snprintf(*buf + *len, *max - *len, "^fg(%s)", section->color);
-                                        while (section_width > 0 && *max - *len > 0)
-                                        {
-                                                if (current_segment_width > 0)
-                                                {
-                                                        if (current_segment_width >= section_width)
-                                                        {
-                                                                *len += snprintf(*buf + *len, *max - *len,
-                                                                                 "^r(%ux%u)",
-                                                                                 section_width,
-                                                                                 section_height);
-                                                                current_segment_width -= section_width;
-                                                                section_width = 0;
-                                                                if (current_segment_width == 0)
-                                                                {
-                                                                        current_gap_width = bar->segment_gap;
-                                                                }
-
-                                                        }
-                                                        else
-                                                        {
-                                                                *len += snprintf(*buf + *len, *max - *len,
-                                                                                 "^r(%ux%u)",
-                                                                                 current_segment_width,
-                                                                                 section_height);
-                                                                section_width -= current_segment_width;
-                                                                current_segment_width = 0;
-                                                                current_gap_width = bar->segment_gap;
-                                                        }
-                                                }
-                                                else
-                                                {
-                                                        if (current_gap_width >= section_width)
-                                                        {
-                                                                *len += snprintf(*buf + *len, *max - *len,
-                                                                                 "^p(%u)",
-                                                                                 section_width);
-                                                                current_gap_width -= section_width;
-                                                                section_width = 0;
-                                                                if (current_gap_width == 0)
-                                                                {
-                                                                        current_segment_width = bar->segment_width;
-                                                                }
-                                                        }
-                                                        else
-                                                        {
-                                                                *len += snprintf(*buf + *len, *max - *len,
-                                                                                 "^p(%u)",
-                                                                                 current_gap_width);
-                                                                section_width -= current_gap_width;
-                                                                current_gap_width = 0;
-                                                                current_segment_width = bar->segment_width;
-                                                        }
-                                                }
-                                        }
-                                }
-                        }
+                        return -err;
                 }
+        }
+
+        gmbar_render(bar, &out);
+        return out.len;
+}
+
+/**
+ * Textualizes the bar.
+ *
+ * The bar is appended to the buffer at @len, and the buffer is grown (at
+ * most once) if it is too small.  The result is zero terminated.
+ *
+ * @param   bar   Bar to textualize
+ * @param   buf   Buffer to append to.  On return, may point to a new
+ *                buffer.  Caller is responsible for freeing the buffer.
+ * @param   len   Length of the existing content in the buffer.  On
+ *                return, includes the appended bar.
+ * @param   max   Size of the buffer.  On return, the new size.
+ * @return  Number of bytes written on success (excluding the terminating
+ *          zero), negative errno on failure.
+ */
+int
+gmbar_format(gmbar* bar, char** buf, int* len, int* max)
+{
+        int err = 0;
+        int size = 0;
+        gmoutput out = { NULL, *len, *max, 0, 0, -1 };
+
+        size = gmbar_format_size(bar);
+        if (size < 0)
+        {
+                return size;
+        }
+
+        err = gmbar_reserve(buf, *len, max, size);
+        if (err)
+        {
+                return -err;
+        }
+
+        out.buf = *buf;
+        out.max = *max;
+        gmbar_render(bar, &out);
+        (*buf)[out.len] = '\0';
+        *len = out.len;
+
+        return size;
+}
+
+/**
+ * Creates a new renderer, without a frame cache.
+ *
+ * @return  A newly allocated renderer or NULL if there was not enough
+ *          memory to allocate one.
+ */
+gmrenderer*
+gmrenderer_new()
+{
+        gmrenderer* renderer = (gmrenderer*) malloc(sizeof(gmrenderer));
+        if (renderer)
+        {
+                memset(renderer, 0, sizeof(gmrenderer));
+        }
+        return renderer;
+}
 
-                if (*max - *len > 0)
+/**
+ * Frees the renderer, its buffers, and its frame cache.
+ */
+void
+gmrenderer_free(gmrenderer* renderer)
+{
+        if (renderer)
+        {
+                gmrenderer_set_cache(renderer, 0, 0);
+                if (renderer->buf)
                 {
-                        /* move position to right margin */
-                        *len += snprintf(*buf + *len, *max - *len, "^p(%d)", width);
+                        free(renderer->buf);
                 }
-
-                if (*max - *len > 0)
+                if (renderer->widths)
                 {
-                        /* everything fits */
-                        break;
+                        free(renderer->widths);
                 }
+                free(renderer);
         }
-        while(1);
+}
 
-        return err;
+/**
+ * Enables, disables, or resizes the frame cache.
+ *
+ * With the cache enabled, a frame with the same section widths as a
+ * recently rendered frame is copied from the cache instead of rendered.
+ * Any cached frames are dropped.
+ *
+ * @param   max_entries   Maximum number of frames, zero disables the cache
+ * @param   max_bytes     Maximum number of bytes, zero for no limit
+ * @return  Zero on success, ENOMEM if memory allocation failed.
+ */
+int
+gmrenderer_set_cache(gmrenderer* renderer, unsigned int max_entries, unsigned int max_bytes)
+{
+        gmcache* cache = renderer->cache;
+
+        if (cache)
+        {
+                gmbar_cache_clear(cache);
+                free(cache->frames);
+                free(cache);
+                renderer->cache = cache = NULL;
+        }
+
+        if (max_entries == 0)
+        {
+                return 0;
+        }
+
+        cache = (gmcache*) malloc(sizeof(gmcache));
+        if (!cache)
+        {
+                return ENOMEM;
+        }
+        memset(cache, 0, sizeof(gmcache));
+        cache->frames = (gmframe*) malloc(sizeof(gmframe) * max_entries);
+        if (!cache->frames)
+        {
+                free(cache);
+                return ENOMEM;
+        }
+        cache->max_entries = max_entries;
+        cache->max_bytes = max_bytes;
+        renderer->cache = cache;
+
+        return 0;
+}
+
+/**
+ * Textualizes the bar into the buffer of the renderer.
+ *
+ * With the frame cache enabled, a frame with the same section widths as
+ * a recently rendered frame is copied from the cache.
+ *
+ * @param   renderer   Renderer
+ * @param   bar        Bar to textualize
+ * @return  Number of bytes in the frame (excluding the terminating zero)
+ *          on success, negative errno on failure.
+ */
+int
+gmrenderer_format(gmrenderer* renderer, gmbar* bar)
+{
+        int err = 0;
+        int size = 0;
+        unsigned int hash = 0;
+        unsigned int* tmp = NULL;
+        gmframe* frame = NULL;
+
+        if (!bar->plan.valid)
+        {
+                err = gmbar_compile(bar);
+                if (err)
+                {
+                        return -err;
+                }
+        }
+
+        /* cached frames were rendered with another plan */
+        if (renderer->generation != bar->plan.generation && renderer->cache)
+        {
+                gmbar_cache_clear(renderer->cache);
+        }
+
+        renderer->len = 0;
+        if (renderer->cache)
+        {
+                hash = gmbar_cache_hash(bar);
+                frame = gmbar_cache_lookup(renderer->cache, bar, hash);
+        }
+        if (frame)
+        {
+                err = gmbar_reserve(&renderer->buf, 0, &renderer->max, frame->len);
+                if (err)
+                {
+                        return -err;
+                }
+                memcpy(renderer->buf, frame->text, frame->len);
+                renderer->buf[frame->len] = '\0';
+                size = renderer->len = frame->len;
+        }
+        else
+        {
+                size = gmbar_format(bar, &renderer->buf, &renderer->len, &renderer->max);
+                if (size < 0)
+                {
+                        return size;
+                }
+                if (renderer->cache)
+                {
+                        gmbar_cache_store(renderer->cache, bar, hash, renderer->buf, size);
+                }
+        }
+
+        /* remember the widths for gmrenderer_unchanged() */
+        renderer->generation = bar->plan.generation;
+        renderer->nwidths = 0;
+        if (renderer->max_widths < bar->nsections)
+        {
+                tmp = (unsigned int*) realloc(renderer->widths, sizeof(unsigned int) * bar->nsections);
+                if (!tmp)
+                {
+                        /* without history, every frame is a change */
+                        return size;
+                }
+                renderer->widths = tmp;
+                renderer->max_widths = bar->nsections;
+        }
+        for (renderer->nwidths = 0; renderer->nwidths < bar->nsections; renderer->nwidths++)
+        {
+                renderer->widths[renderer->nwidths] = bar->sections[renderer->nwidths].width;
+        }
+
+        return size;
+}
+
+/**
+ * Checks whether the bar would textualize to the last frame.
+ *
+ * @return  Non-zero if the bar has not changed since the last frame,
+ *          zero otherwise.
+ */
+int
+gmrenderer_unchanged(const gmrenderer* renderer, const gmbar* bar)
+{
+        unsigned int i = 0;
+
+        if (!bar->plan.valid
+            || renderer->generation != bar->plan.generation
+            || renderer->nwidths != bar->nsections)
+        {
+                return 0;
+        }
+        for (i = 0; i < bar->nsections; i++)
+        {
+                if (renderer->widths[i] != bar->sections[i].width)
+                {
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+/**
+ * Measures how much the bar has changed since the last frame.
+ *
+ * @return  The largest difference in pixels between the width of a
+ *          section and its width in the last frame, or UINT_MAX if the
+ *          bar can not be compared with the last frame.
+ */
+unsigned int
+gmrenderer_change(const gmrenderer* renderer, const gmbar* bar)
+{
+        unsigned int change = 0;
+        unsigned int diff = 0;
+        unsigned int i = 0;
+
+        if (!bar->plan.valid
+            || renderer->generation != bar->plan.generation
+            || renderer->nwidths != bar->nsections)
+        {
+                return UINT_MAX;
+        }
+        for (i = 0; i < bar->nsections; i++)
+        {
+                diff = renderer->widths[i] > bar->sections[i].width
+                        ? renderer->widths[i] - bar->sections[i].width
+                        : bar->sections[i].width - renderer->widths[i];
+                if (diff > change)
+                {
+                        change = diff;
+                }
+        }
+        return change;
+}
+
+/**
+ * Makes sure there is room for @size bytes and the terminating zero
+ * after @len bytes in the buffer.
+ *
+ * @return  Zero on success, errno on failure.
+ */
+static int
+gmbar_reserve(char** buf, int len, int* max, int size)
+{
+        char* tmp = NULL;
+
+        if (*max < len + size + 1)
+        {
+                tmp = realloc(*buf, len + size + 1);
+                if (!tmp)
+                {
+                        return errno;
+                }
+                *buf = tmp;
+                *max = len + size + 1;
+        }
+        return 0;
+}
+
+/**
+ * Computes a hash of the section widths.
+ */
+static unsigned int
+gmbar_cache_hash(const gmbar* bar)
+{
+        unsigned int hash = 2166136261u;
+        unsigned int i = 0;
+
+        for (i = 0; i < bar->nsections; i++)
+        {
+                hash = (hash ^ bar->sections[i].width) * 16777619u;
+        }
+        return hash;
+}
+
+/**
+ * Finds a frame with the same section widths as the bar has.
+ *
+ * @return  The frame, or NULL if not found.
+ */
+static gmframe*
+gmbar_cache_lookup(gmcache* cache, const gmbar* bar, unsigned int hash)
+{
+        unsigned int i = 0;
+        unsigned int j = 0;
+        gmframe* frame = NULL;
+
+        cache->clock++;
+        for (i = 0; i < cache->nentries; i++)
+        {
+                frame = &cache->frames[i];
+                if (frame->hash != hash)
+                {
+                        continue;
+                }
+                for (j = 0; j < bar->nsections && frame->widths[j] == bar->sections[j].width; j++)
+                        ;
+                if (j == bar->nsections)
+                {
+                        frame->used = cache->clock;
+                        cache->hits++;
+                        return frame;
+                }
+        }
+        cache->misses++;
+        return NULL;
+}
+
+/**
+ * Stores a frame rendered with the current section widths.
+ *
+ * Least recently used frames are evicted to make room.  If the memory
+ * allocation fails, the frame is not cached.
+ */
+static void
+gmbar_cache_store(gmcache* cache, const gmbar* bar, unsigned int hash,
+                  const char* text, unsigned int len)
+{
+        const unsigned int size = sizeof(unsigned int) * bar->nsections + len;
+        unsigned int i = 0;
+        gmframe* frame = NULL;
+
+        if (cache->max_bytes && size > cache->max_bytes)
+        {
+                return;
+        }
+        while (cache->nentries == cache->max_entries
+               || (cache->max_bytes && cache->bytes + size > cache->max_bytes))
+        {
+                gmbar_cache_evict(cache);
+        }
+
+        frame = &cache->frames[cache->nentries];
+        frame->widths = (unsigned int*) malloc(size);
+        if (!frame->widths)
+        {
+                return;
+        }
+        frame->text = (char*)(frame->widths + bar->nsections);
+        frame->size = size;
+        frame->len = len;
+        frame->hash = hash;
+        frame->used = cache->clock;
+        for (i = 0; i < bar->nsections; i++)
+        {
+                frame->widths[i] = bar->sections[i].width;
+        }
+        memcpy(frame->text, text, len);
+
+        cache->nentries++;
+        cache->bytes += size;
+}
+
+/**
+ * Evicts the least recently used frame.
+ */
+static void
+gmbar_cache_evict(gmcache* cache)
+{
+        unsigned int i = 0;
+        unsigned int lru = 0;
+
+        for (i = 1; i < cache->nentries; i++)
+        {
+                if (cache->frames[i].used < cache->frames[lru].used)
+                {
+                        lru = i;
+                }
+        }
+
+        cache->bytes -= cache->frames[lru].size;
+        free(cache->frames[lru].widths);
+        cache->frames[lru] = cache->frames[--cache->nentries];
+}
+
+/**
+ * Drops all the frames.
+ */
+static void
+gmbar_cache_clear(gmcache* cache)
+{
+        while (cache->nentries)
+        {
+                gmbar_cache_evict(cache);
+        }
+}
+
+/**
+ * Appends a string to the output.
+ */
+static void
+gmbar_emit_str(gmoutput* out, const char* str, unsigned int len)
+{
+        if (out->buf)
+        {
+                memcpy(out->buf + out->len, str, len);
+        }
+        out->len += len;
+}
+
+/**
+ * Appends a base ten value to the output.
+ */
+static void
+gmbar_emit_uint(gmoutput* out, unsigned int value)
+{
+        char digits[10];
+        unsigned int i = sizeof(digits);
+
+        do
+        {
+                digits[--i] = '0' + value % 10;
+                value /= 10;
+        }
+        while (value);
+
+        gmbar_emit_str(out, digits + i, sizeof(digits) - i);
+}
+
+/**
+ * Appends a signed base ten value to the output.
+ */
+static void
+gmbar_emit_int(gmoutput* out, int value)
+{
+        if (value < 0)
+        {
+                gmbar_emit_str(out, "-", 1);
+                gmbar_emit_uint(out, -(unsigned int)value);
+        }
+        else
+        {
+                gmbar_emit_uint(out, value);
+        }
+}
+
+/**
+ * Appends "^fg(COLOR)" to the output.
+ */
+static void
+gmbar_emit_fg(gmoutput* out, const char* color)
+{
+        gmbar_emit_str(out, "^fg(", 4);
+        gmbar_emit_str(out, color, strlen(color));
+        gmbar_emit_str(out, ")", 1);
+}
+
+/**
+ * Appends "^r(WIDTHxHEIGHT)" or similar to the output.
+ *
+ * @param   token   Start of the token, e.g. "^r("
+ * @param   len     Length of the token
+ */
+static void
+gmbar_emit_rect(gmoutput* out, const char* token, unsigned int len,
+                unsigned int width, unsigned int height)
+{
+        gmbar_emit_str(out, token, len);
+        gmbar_emit_uint(out, width);
+        gmbar_emit_str(out, "x", 1);
+        gmbar_emit_uint(out, height);
+        gmbar_emit_str(out, ")", 1);
+}
+
+/**
+ * Appends "^p(WIDTH)" to the output.
+ */
+static void
+gmbar_emit_move(gmoutput* out, int width)
+{
+        gmbar_emit_str(out, "^p(", 3);
+        gmbar_emit_int(out, width);
+        gmbar_emit_str(out, ")", 1);
+}
+
+/**
+ * Appends "^r(WIDTHxHEIGHT)" for a section rectangle to the output.
+ */
+static void
+gmbar_emit_section(gmoutput* out, const gmplan* plan, unsigned int width)
+{
+        gmbar_emit_str(out, "^r(", 3);
+        gmbar_emit_uint(out, width);
+        gmbar_emit_str(out, plan->text + plan->height, plan->height_len);
+}
+
+/**
+ * Moves the cursor.
+ */
+static void
+gmbar_out_move(gmoutput* out, const gmplan* plan, int width)
+{
+        if (out->rect)
+        {
+                gmbar_emit_section(out, plan, out->rect);
+                out->rect = 0;
+        }
+        out->move += width;
+}
+
+/**
+ * Draws a section rectangle in the current color.
+ */
+static void
+gmbar_out_rect(gmoutput* out, const gmplan* plan, unsigned int width)
+{
+        if (out->move)
+        {
+                gmbar_emit_move(out, out->move);
+                out->move = 0;
+        }
+        out->rect += width;
+}
+
+/**
+ * Changes the current color to the section color.
+ */
+static void
+gmbar_out_color(gmoutput* out, const gmplan* plan, const gmsection* section)
+{
+        if (out->color != section->color_id)
+        {
+                if (out->rect)
+                {
+                        gmbar_emit_section(out, plan, out->rect);
+                        out->rect = 0;
+                }
+                gmbar_emit_str(out, plan->text + section->token, section->token_len);
+                out->color = section->color_id;
+        }
+}
+
+/**
+ * Writes the pending rectangle and cursor movement.
+ */
+static void
+gmbar_out_flush(gmoutput* out, const gmplan* plan)
+{
+        if (out->rect)
+        {
+                gmbar_emit_section(out, plan, out->rect);
+                out->rect = 0;
+        }
+        if (out->move)
+        {
+                gmbar_emit_move(out, out->move);
+                out->move = 0;
+        }
+}
+
+/**
+ * Draws a segmented section rectangle in the current color.
+ *
+ * Only the first and the last segment or gap are computed; the ones in
+ * between are always full, and are copied from the segment pattern of
+ * the plan.
+ *
+ * @param   phase   Position in the segment pattern, zero being the
+ *                  start of a segment and segment width the start of
+ *                  a gap
+ * @param   width   Width of the section
+ * @return  Position in the segment pattern after the section.
+ */
+static unsigned int
+gmbar_out_segments(gmoutput* out, const gmbar* bar, unsigned int phase, unsigned int width)
+{
+        const gmplan* plan = &bar->plan;
+        unsigned int period = bar->segment_width + bar->segment_gap;
+        unsigned int chunk = plan->pattern_periods * 2;
+        /* non-zero if the first run is a segment, zero if a gap */
+        unsigned int drawing = phase < bar->segment_width;
+        unsigned int first = (drawing ? bar->segment_width : period) - phase;
+        unsigned int last = 0;
+        unsigned int full = drawing ? bar->segment_gap : bar->segment_width;
+        unsigned int n = 0;
+        const char* pattern = plan->text + plan->pattern + (drawing ? 0 : plan->gap_len);
+
+        if (first > width)
+        {
+                first = width;
+        }
+        if (drawing)
+        {
+                gmbar_out_rect(out, plan, first);
+        }
+        else
+        {
+                gmbar_out_move(out, plan, first);
+        }
+        width -= first;
+        if (width == 0)
+        {
+                return (phase + first) % period;
+        }
+
+        /* number of full runs in between, and the width of the last run */
+        n = width / period * 2;
+        last = width % period;
+        if (last == 0)
+        {
+                n--;
+                last = period - full;
+        }
+        else if (last > full)
+        {
+                n++;
+                last -= full;
+        }
+
+        if (n)
+        {
+                gmbar_out_flush(out, plan);
+                while (n > chunk)
+                {
+                        gmbar_emit_str(out, pattern,
+                                       plan->pattern_periods * (plan->gap_len + plan->segment_len));
+                        n -= chunk;
+                }
+                gmbar_emit_str(out, pattern,
+                               n / 2 * (plan->gap_len + plan->segment_len)
+                               + (n % 2 ? (drawing ? plan->gap_len : plan->segment_len) : 0));
+        }
+
+        /* runs alternate, odd number in between means same kind as first */
+        if (drawing == n % 2)
+        {
+                gmbar_out_rect(out, plan, last);
+        }
+        else
+        {
+                gmbar_out_move(out, plan, last);
+        }
+
+        return (phase + first + width) % period;
+}
+
+/**
+ * Compiles the rendering plan.
+ *
+ * @return  Zero on success, errno on failure.
+ */
+static int
+gmbar_compile(gmbar* bar)
+{
+        gmoutput out = { NULL, 0, 0, 0, 0, -1 };
+        char* text = NULL;
+
+        bar->plan.width = bar->size.width - bar->margin.left - bar->margin.right
+                - bar->padding.left + bar->margin.right;
+        bar->plan.segmented = bar->segment_width > 0 && bar->segment_gap > 0;
+
+        /* count the length of the text, then render it */
+        gmbar_compile_text(bar, &out);
+        text = (char*) malloc(out.len);
+        if (!text)
+        {
+                return errno;
+        }
+        out.buf = text;
+        out.max = out.len;
+        out.len = 0;
+        gmbar_compile_text(bar, &out);
+
+        if (bar->plan.text)
+        {
+                free(bar->plan.text);
+        }
+        bar->plan.text = text;
+        bar->plan.valid = 1;
+
+        /* unique across bars, so renderers can tell plans apart */
+        bar->plan.generation = __sync_add_and_fetch(&gmbar_generation, 1);
+
+        return 0;
+}
+
+/**
+ * Renders the text of the rendering plan.
+ *
+ * @param   bar   Bar to compile
+ * @param   out   Output
+ */
+static void
+gmbar_compile_text(gmbar* bar, gmoutput* out)
+{
+        /* width of the bar without margins */
+        int bar_width = bar->size.width - bar->margin.left - bar->margin.right;
+        /* height of the sections */
+        unsigned int section_height = bar->size.height
+                - bar->margin.top - bar->margin.bottom
+                - bar->padding.top - bar->padding.bottom;
+        unsigned int i = 0;
+        gmsection* section = NULL;
+
+        const char* color = NULL;
+        unsigned int j = 0;
+
+        out->move = 0;
+
+        /* draw the background, if not none */
+        if (strcmp(bar->color.bg, "none"))
+        {
+                gmbar_emit_fg(out, bar->color.bg);
+                gmbar_emit_rect(out, "^r(", 3, bar->size.width, bar->size.height);
+                out->move = -bar->size.width;
+                color = bar->color.bg;
+        }
+
+        /* ignore background for the rest of the drawing */
+        gmbar_emit_str(out, "^ib(1)", 6);
+
+        /* leave margin */
+        out->move += bar->margin.left;
+
+        /* draw the outline, if color is not none */
+        if (strcmp(bar->color.fg, "none"))
+        {
+                if (out->move)
+                {
+                        gmbar_emit_move(out, out->move);
+                }
+                gmbar_emit_fg(out, bar->color.fg);
+                gmbar_emit_rect(out, "^ro(", 4, bar_width,
+                                bar->size.height - bar->margin.top - bar->margin.bottom);
+                out->move = -bar_width;
+                color = bar->color.fg;
+        }
+
+        /* leave padding */
+        out->move += bar->padding.left;
+
+        bar->plan.prologue_len = out->len;
+        bar->plan.prologue_move = out->move;
+        bar->plan.prologue_color = color ? 0 : -1;
+
+        /* section colors, nothing for "none" */
+        for (i = 0, section = bar->sections; i < bar->nsections; i++, section++)
+        {
+                section->token = out->len;
+                section->color_id = i + 1;
+                if (strcmp(section->color, "none"))
+                {
+                        gmbar_emit_fg(out, section->color);
+
+                        /* same color as the prologue or an earlier section */
+                        if (color && strcmp(section->color, color) == 0)
+                        {
+                                section->color_id = 0;
+                        }
+                        for (j = 0; j < i && section->color_id == i + 1; j++)
+                        {
+                                if (bar->sections[j].token_len
+                                    && strcmp(section->color, bar->sections[j].color) == 0)
+                                {
+                                        section->color_id = bar->sections[j].color_id;
+                                }
+                        }
+                }
+                section->token_len = out->len - section->token;
+        }
+
+        /* the end of the section rectangles */
+        bar->plan.height = out->len;
+        gmbar_emit_str(out, "x", 1);
+        gmbar_emit_uint(out, section_height);
+        gmbar_emit_str(out, ")", 1);
+        bar->plan.height_len = out->len - bar->plan.height;
+
+        /* segment pattern, long enough to cover the bar in one copy */
+        if (bar->plan.segmented)
+        {
+                bar->plan.pattern = out->len;
+                bar->plan.pattern_periods = (bar->plan.width > 0 ? bar->plan.width : 0)
+                        / (bar->segment_width + bar->segment_gap) + 1;
+                gmbar_emit_move(out, bar->segment_gap);
+                bar->plan.gap_len = out->len - bar->plan.pattern;
+                gmbar_emit_rect(out, "^r(", 3, bar->segment_width, section_height);
+                bar->plan.segment_len = out->len - bar->plan.pattern - bar->plan.gap_len;
+                for (i = 1; i < bar->plan.pattern_periods; i++)
+                {
+                        gmbar_emit_move(out, bar->segment_gap);
+                        gmbar_emit_rect(out, "^r(", 3, bar->segment_width, section_height);
+                }
+                gmbar_emit_move(out, bar->segment_gap);
+        }
+}
+
+/**
+ * Renders the bar.
+ *
+ * @param   bar   Bar to textualize
+ * @param   out   Output
+ */
+static void
+gmbar_render(const gmbar* bar, gmoutput* out)
+{
+        const gmplan* plan = &bar->plan;
+        /* number of pixels from the start of the first section to the
+         * right margin */
+        int width = plan->width;
+        /* position in the segment pattern */
+        unsigned int phase = 0;
+
+        unsigned int i = 0;
+        gmsection* section = NULL;
+
+        /* background, outline, margin, and padding */
+        gmbar_emit_str(out, plan->text, plan->prologue_len);
+        out->move = plan->prologue_move;
+        out->rect = 0;
+        out->color = plan->prologue_color;
+
+        /* draw the sections */
+        for (i = 0, section = bar->sections;
+             i < bar->nsections;
+             i++, width -= section->width, section++)
+        {
+                if (section->width == 0)
+                {
+                        // nothing to do
+                }
+                else if (section->token_len == 0)
+                {
+                        gmbar_out_move(out, plan, section->width);
+                }
+                else if (!plan->segmented)
+                {
+                        gmbar_out_color(out, plan, section);
+                        gmbar_out_rect(out, plan, section->width);
+                }
+                else
+                {
+                        gmbar_out_color(out, plan, section);
+                        phase = gmbar_out_segments(out, bar, phase, section->width);
+                }
+        }
+
+        /* move position to right margin */
+        gmbar_out_move(out, plan, width);
+        gmbar_out_flush(out, plan);
 }
@@ -49,6 +49,97 @@ struct gmsection {
         unsigned int width;
         /** Color of the section */
         char* color;
+        /** Offset of the pre-rendered color token in the plan text */
+        unsigned int token;
+        /** Length of the pre-rendered color token, zero if color is "none" */
+        unsigned int token_len;
+        /** Sections with the same color have the same color id */
+        int color_id;
+};
+
+/**
+ * Structure to represent the parts of the textual bar that do not
+ * change from frame to frame.
+ *
+ * The plan is compiled on demand, and invalidated by the gmbar_set_*()
+ * functions.
+ */
+typedef struct gmplan gmplan;
+struct gmplan {
+        /** Non-zero if the plan is up to date */
+        unsigned int valid;
+        /** Unique number of the compiled plan, for telling plans apart */
+        unsigned int generation;
+        /** Pre-rendered tokens: the prologue, section colors, and the
+         * height suffix of section rectangles */
+        char* text;
+        /** Length of the prologue (background, outline, margin, padding) */
+        unsigned int prologue_len;
+        /** Cursor movement at the end of the prologue, not in the text */
+        int prologue_move;
+        /** Color id of the color set in the prologue, -1 if none */
+        int prologue_color;
+        /** Offset of the pre-rendered "xHEIGHT)" suffix */
+        unsigned int height;
+        /** Length of the pre-rendered "xHEIGHT)" suffix */
+        unsigned int height_len;
+        /** Number of pixels from the start of the first section to the
+         * right margin */
+        int width;
+        /** Non-zero if sections are drawn in segments */
+        unsigned int segmented;
+        /** Offset of the pre-rendered segment pattern, "^p(GAP)^r(SEGMENT)"
+         * repeated @pattern_periods times and followed by one "^p(GAP)" */
+        unsigned int pattern;
+        /** Number of periods in the segment pattern */
+        unsigned int pattern_periods;
+        /** Length of the "^p(GAP)" token in the segment pattern */
+        unsigned int gap_len;
+        /** Length of the "^r(SEGMENT)" token in the segment pattern */
+        unsigned int segment_len;
+};
+
+/**
+ * Structure to represent a rendered frame in the frame cache.
+ */
+typedef struct gmframe gmframe;
+struct gmframe {
+        /** Hash of the section widths */
+        unsigned int hash;
+        /** Value of the cache clock when the frame was last used */
+        unsigned long used;
+        /** Section widths, one per section, followed by the text */
+        unsigned int* widths;
+        /** Rendered frame, not zero terminated */
+        char* text;
+        /** Length of the rendered frame */
+        unsigned int len;
+        /** Size of the memory block pointed by widths */
+        unsigned int size;
+};
+
+/**
+ * Structure to represent a cache of rendered frames, keyed by the section
+ * widths.  The least recently used frame is evicted when the cache is full.
+ */
+typedef struct gmcache gmcache;
+struct gmcache {
+        /** Maximum number of frames */
+        unsigned int max_entries;
+        /** Maximum number of bytes used by the frames, zero for no limit */
+        unsigned int max_bytes;
+        /** Number of cached frames */
+        unsigned int nentries;
+        /** Number of bytes used by the frames */
+        unsigned int bytes;
+        /** Incremented on every lookup */
+        unsigned long clock;
+        /** Number of lookups that found a frame */
+        unsigned long hits;
+        /** Number of lookups that did not find a frame */
+        unsigned long misses;
+        /** Cached frames */
+        gmframe* frames;
 };
 
 /**
@@ -72,33 +163,110 @@ struct gmbar {
         unsigned int granularity;
         /** Section width rounding */
         double rounding;
+        /** Section width rounding in 1/65536 pixels, half of granularity
+         * if @rounding is zero */
+        unsigned int rounding_fp;
         /** Number of sections */
-        unsigned char nsections;
-        /** List of sections */
-        gmsection** sections;
+        unsigned int nsections;
+        /** Number of sections there is room for */
+        unsigned int max_sections;
+        /** Sections, in one contiguous block */
+        gmsection* sections;
+        /** Storage for the bar and section color strings */
+        char* arena;
+        /** Number of bytes used in the arena */
+        unsigned int arena_len;
+        /** Size of the arena */
+        unsigned int arena_max;
+        /** Rendering plan */
+        gmplan plan;
+};
+
+/**
+ * Structure to represent the state for textualizing bars: the output
+ * buffer, the optional frame cache, and the section widths of the last
+ * frame.
+ *
+ * Different bars can be textualized at the same time in different
+ * threads, each with its own renderer.
+ */
+typedef struct gmrenderer gmrenderer;
+struct gmrenderer {
+        /** Last frame, zero terminated */
+        char* buf;
+        /** Length of the last frame */
+        int len;
+        /** Size of the output buffer */
+        int max;
+        /** Frame cache, or NULL if disabled */
+        gmcache* cache;
+        /** Generation of the plan the last frame was rendered with */
+        unsigned int generation;
+        /** Section widths of the last frame */
+        unsigned int* widths;
+        /** Number of section widths of the last frame */
+        unsigned int nwidths;
+        /** Size of the widths array */
+        unsigned int max_widths;
 };
 
 
 gmbar*           gmbar_new                    ();
 gmbar*           gmbar_new_with_defaults      (unsigned int width,
                                                unsigned int height,
-                                               char* fg,
-                                               char* bg);
+                                               const char* fg,
+                                               const char* bg,
+                                               unsigned int nsections);
 void             gmbar_free                   (gmbar* bar);
 
 int              gmbar_add_section            (gmbar* bar,
-                                               char* color);
+                                               const char* color);
 int              gmbar_add_sections           (gmbar* bar,
                                                unsigned int nsections,
                                                ...);
 void             gmbar_set_section_width      (gmsection* section,
                                                unsigned int total,
                                                unsigned int value);
+void             gmbar_set_section_widths     (gmbar* bar,
+                                               unsigned int total,
+                                               const unsigned int* values);
+int              gmbar_set_section_color      (gmsection* section,
+                                               const char* color);
 
+void             gmbar_set_size               (gmbar* bar,
+                                               unsigned int width,
+                                               unsigned int height);
+void             gmbar_set_margin             (gmbar* bar,
+                                               gmmargin margin);
+void             gmbar_set_padding            (gmbar* bar,
+                                               gmmargin padding);
+int              gmbar_set_color              (gmbar* bar,
+                                               const char* fg,
+                                               const char* bg);
+void             gmbar_set_segments           (gmbar* bar,
+                                               unsigned int width,
+                                               unsigned int gap);
+void             gmbar_set_granularity        (gmbar* bar,
+                                               unsigned int granularity,
+                                               double rounding);
+void             gmbar_invalidate             (gmbar* bar);
+
+int              gmbar_format_size            (gmbar* bar);
 int              gmbar_format                 (gmbar* bar,
-                                               unsigned int nl,
                                                char** buf,
                                                int* len,
                                                int* max);
 
+gmrenderer*      gmrenderer_new               ();
+void             gmrenderer_free              (gmrenderer* renderer);
+int              gmrenderer_set_cache         (gmrenderer* renderer,
+                                               unsigned int max_entries,
+                                               unsigned int max_bytes);
+int              gmrenderer_format            (gmrenderer* renderer,
+                                               gmbar* bar);
+int              gmrenderer_unchanged         (const gmrenderer* renderer,
+                                               const gmbar* bar);
+unsigned int     gmrenderer_change            (const gmrenderer* renderer,
+                                               const gmbar* bar);
+
 #endif // LIBGMBAR_H
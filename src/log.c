@@ -1,41 +1,106 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <time.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <sys/uio.h>
 
 #include "log.h"
 
+/* Size of the ring of records waiting to be written */
+#define LOG_RING_SIZE 16384
+/* The ring is written out on the next tick when it is fuller than this */
+#define LOG_FLUSH_SIZE (LOG_RING_SIZE / 2)
+/* Longest time in seconds a record waits in the ring */
+#define LOG_FLUSH_DELAY 1
+/* Longest record, longer ones are cut */
+#define LOG_RECORD_SIZE 512
+/* Repeats of a message are summarized at least this often, in seconds */
+#define LOG_REPEAT_INTERVAL 10
+
 extern char* program_invocation_short_name;
 
-static FILE* log = NULL;
+static int log = -1;
+static int log_level = LOG_LEVEL_INFO;
 static char hostname[256];
-static char datetime[25];
 
-static void log_prefix();
-static void log_suffix();
+/* "DATE HOSTNAME PROGRAM: " of the second it was formatted for */
+static time_t log_prefix_time = -1;
+static char log_prefix_text[320];
+static int log_prefix_len = 0;
+
+/* Records not written yet */
+static char log_ring[LOG_RING_SIZE];
+static unsigned int log_ring_head = 0;
+static unsigned int log_ring_len = 0;
+static time_t log_ring_time = 0;
+/* Records dropped because the ring was full */
+static unsigned long log_dropped = 0;
+
+/* The latest message, and how many times it has been repeated since */
+static char log_last[LOG_RECORD_SIZE];
+static int log_last_len = -1;
+static unsigned long log_repeats = 0;
+static time_t log_repeat_time = 0;
+
+static const char* const log_level_names[] = {
+        "error",
+        "warning",
+        "info",
+        "debug",
+};
+
+static void log_write       ();
+static void log_vmessage    (int level,
+                             char* frmt,
+                             va_list argv);
+static void log_record      (time_t now,
+                             const char* text,
+                             int len);
+static void log_repeated    (time_t now);
+static void log_prefix      (time_t now);
+static void log_append      (const char* data,
+                             unsigned int len);
 
 /**
+ * Opens the log file for appending, closing the previous one.
+ *
+ * The records are kept in memory and written in batches by log_tick():
+ * when there are many of them, or when the oldest is a second old; and
+ * on exit.  Logging itself never writes, so it does not block the
+ * caller; if the records come faster than the ticks write them, the
+ * ring fills up and the records that do not fit are dropped and counted.
  *
+ * @param   filename   Name of the log file
+ * @return  Zero on success, errno on failure.
  */
 int log_open(char* filename)
 {
+        static int registered = 0;
         int err = 0;
-        if (log)
+        if (log != -1)
         {
                 err = log_close();
         }
         if (!err)
         {
-                log = fopen(filename, "a");
-                if (!log)
+                log = open(filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+                if (log == -1)
                 {
                         err = errno;
                 }
         }
+        if (!err && !registered)
+        {
+                registered = atexit(log_flush) == 0;
+        }
         if (!err)
         {
+                /* the prefix is formatted again with the new hostname */
+                log_prefix_time = -1;
                 err = gethostname(hostname, 255);
                 if (err)
                 {
@@ -47,80 +112,329 @@ int log_open(char* filename)
 }
 
 /**
+ * Writes the records waiting in memory, and closes the log file.
  *
+ * @return  Zero on success, errno on failure.
  */
 int log_close()
 {
         int err = 0;
-        if (log)
+        if (log != -1)
         {
-                err = fclose(log);
+                log_flush();
+                err = close(log);
                 /* error or not, log should not be accessed */
-                log = NULL;
+                log = -1;
         }
-        return err == EOF ? errno : 0;
+        return err == -1 ? errno : 0;
 }
 
 /**
+ * Sets the least severe level that is logged.
  *
+ * @param   name   Name of the level: error, warning, info, or debug
+ * @return  Zero on success, EINVAL if there is no such level.
+ */
+int log_set_level(const char* name)
+{
+        unsigned int i = 0;
+
+        for (i = 0; i < sizeof(log_level_names) / sizeof(log_level_names[0]); i++)
+        {
+                if (strcmp(name, log_level_names[i]) == 0)
+                {
+                        log_level = i;
+                        return 0;
+                }
+        }
+        return EINVAL;
+}
+
+/**
+ * Logs a message with the given severity, if the level is logged.
+ */
+void log_message(int level, char* frmt, ...)
+{
+        va_list argv;
+
+        va_start(argv, frmt);
+        log_vmessage(level, frmt, argv);
+        va_end(argv);
+}
+
+/**
+ * Logs an error.
  */
 void log_error(char* frmt, ...)
 {
         va_list argv;
-        if (log)
-        {
-                log_prefix();
 
-                va_start(argv, frmt);
-                vfprintf(log, frmt, argv);
-                va_end(argv);
+        va_start(argv, frmt);
+        log_vmessage(LOG_LEVEL_ERROR, frmt, argv);
+        va_end(argv);
+}
+
+/**
+ * Logs a warning.
+ */
+void log_warning(char* frmt, ...)
+{
+        va_list argv;
+
+        va_start(argv, frmt);
+        log_vmessage(LOG_LEVEL_WARNING, frmt, argv);
+        va_end(argv);
+}
+
+/**
+ * Logs an informational message.
+ */
+void log_info(char* frmt, ...)
+{
+        va_list argv;
+
+        va_start(argv, frmt);
+        log_vmessage(LOG_LEVEL_INFO, frmt, argv);
+        va_end(argv);
+}
+
+/**
+ * Writes the records waiting in memory to the log file, followed by the
+ * number of records dropped since the previous flush, if any.  If the
+ * file can not be written, the records are dropped.
+ */
+void log_flush()
+{
+        char text[64];
+        time_t now = 0;
+        int len = 0;
+
+        if (log == -1)
+        {
+                return;
+        }
 
-                log_suffix();
+        now = time(NULL);
+        log_repeated(now);
+        log_write();
+        if (log_dropped)
+        {
+                len = snprintf(text, sizeof(text), "warning: dropped %lu messages",
+                               log_dropped);
+                log_dropped = 0;
+                log_record(now, text, len);
+                log_write();
         }
 }
 
 /**
- * Tries to output "DATE HOSTNAME PROGRAM: " into log.
+ * Writes the ring to the log file.
  */
-void log_prefix()
+static void log_write()
 {
-        if (log)
+        struct iovec iov[2];
+        unsigned int first = 0;
+        ssize_t bytes = 0;
+
+        while (log_ring_len)
         {
-                const time_t _t = time(NULL);
-                const struct tm* t = localtime(&_t);
-                if (t)
+                first = LOG_RING_SIZE - log_ring_head;
+                if (first > log_ring_len)
                 {
-                        //Apr 16 12:15:45
-                        strftime(datetime, 25, "%b %d %T", t);
+                        first = log_ring_len;
                 }
-                else
+                iov[0].iov_base = log_ring + log_ring_head;
+                iov[0].iov_len  = first;
+                iov[1].iov_base = log_ring;
+                iov[1].iov_len  = log_ring_len - first;
+
+                bytes = writev(log, iov, iov[1].iov_len ? 2 : 1);
+                if (bytes == -1 && errno == EINTR)
                 {
-                        memcpy(datetime, "xxx xx xx:xx:xx", 25);
+                        continue;
                 }
-                if (hostname[0] != '\0')
+                if (bytes <= 0)
                 {
-                        fprintf(log, "%s %s %s: ",
-                                datetime,
-                                hostname,
-                                program_invocation_short_name);
+                        /* nowhere to report it, drop the records */
+                        bytes = log_ring_len;
                 }
-                else
+                log_ring_head = (log_ring_head + bytes) % LOG_RING_SIZE;
+                log_ring_len -= bytes;
+        }
+}
+
+/**
+ * Writes the records waiting in memory if the oldest of them has waited
+ * long enough, or if there are many of them.  Meant to be called
+ * regularly from the event loop, e.g. on every wakeup; this is the only
+ * place, besides log_flush() and log_close(), where the log is written.
+ */
+void log_tick()
+{
+        time_t now = 0;
+
+        if (log == -1 || (!log_ring_len && !log_repeats && !log_dropped))
+        {
+                return;
+        }
+        now = time(NULL);
+        if (log_ring_len > LOG_FLUSH_SIZE || log_dropped
+            || (log_ring_len && now - log_ring_time >= LOG_FLUSH_DELAY)
+            || (log_repeats && now - log_repeat_time >= LOG_REPEAT_INTERVAL))
+        {
+                log_flush();
+        }
+}
+
+/**
+ * Checks whether there are records waiting to be written, or repeats of
+ * a message waiting to be summarized.
+ *
+ * @return  Non-zero if log_tick() has something to do later.
+ */
+int log_pending()
+{
+        return log != -1 && (log_ring_len || log_repeats || log_dropped);
+}
+
+/**
+ * Formats the message, and adds it to the ring unless it repeats the
+ * previous message.
+ */
+static void log_vmessage(int level, char* frmt, va_list argv)
+{
+        char text[LOG_RECORD_SIZE];
+        time_t now = 0;
+        int len = 0;
+
+        if (log == -1 || level > log_level)
+        {
+                return;
+        }
+
+        len = snprintf(text, sizeof(text), "%s: ", log_level_names[level]);
+        len += vsnprintf(text + len, sizeof(text) - len, frmt, argv);
+        if (len >= (int) sizeof(text))
+        {
+                len = sizeof(text) - 1;
+        }
+
+        now = time(NULL);
+        if (len == log_last_len && memcmp(text, log_last, len) == 0)
+        {
+                /* repeated messages are only counted, and the count is
+                 * logged once in a while and when the message changes */
+                if (!log_repeats++)
+                {
+                        log_repeat_time = now;
+                }
+                if (now - log_repeat_time >= LOG_REPEAT_INTERVAL)
                 {
-                        fprintf(log, "%s %s: ",
-                                datetime,
-                                program_invocation_short_name);
+                        log_repeated(now);
                 }
+                return;
         }
+
+        log_repeated(now);
+        memcpy(log_last, text, len);
+        log_last_len = len;
+        log_record(now, text, len);
 }
 
 /**
- * Outputs "\n" to the log and flushes it.
+ * Adds "DATE HOSTNAME PROGRAM: TEXT\n" to the ring.  If there is no room
+ * for it, the record is dropped and counted.
  */
-void log_suffix()
+static void log_record(time_t now, const char* text, int len)
 {
-        if (log)
+        log_prefix(now);
+        if (LOG_RING_SIZE - log_ring_len < (unsigned int) (log_prefix_len + len + 1))
+        {
+                log_dropped++;
+                return;
+        }
+        if (!log_ring_len)
         {
-                fprintf(log, "\n");
-                fflush(log);
+                log_ring_time = now;
         }
+        log_append(log_prefix_text, log_prefix_len);
+        log_append(text, len);
+        log_append("\n", 1);
+}
+
+/**
+ * Logs how many times the previous message was repeated, if it was.
+ */
+static void log_repeated(time_t now)
+{
+        char text[64];
+        int len = 0;
+
+        if (log_repeats)
+        {
+                len = snprintf(text, sizeof(text), "last message repeated %lu times",
+                               log_repeats);
+                log_repeats = 0;
+                log_repeat_time = now;
+                log_record(now, text, len);
+        }
+}
+
+/**
+ * Formats "DATE HOSTNAME PROGRAM: " for the second @now, unless it is
+ * formatted already.
+ */
+static void log_prefix(time_t now)
+{
+        char datetime[25];
+        struct tm t;
+
+        if (now == log_prefix_time)
+        {
+                return;
+        }
+        log_prefix_time = now;
+
+        if (localtime_r(&now, &t))
+        {
+                //Apr 16 12:15:45
+                strftime(datetime, 25, "%b %d %T", &t);
+        }
+        else
+        {
+                memcpy(datetime, "xxx xx xx:xx:xx", 16);
+        }
+        if (hostname[0] != '\0')
+        {
+                log_prefix_len = snprintf(log_prefix_text, sizeof(log_prefix_text), "%s %s %s: ",
+                                          datetime,
+                                          hostname,
+                                          program_invocation_short_name);
+        }
+        else
+        {
+                log_prefix_len = snprintf(log_prefix_text, sizeof(log_prefix_text), "%s %s: ",
+                                          datetime,
+                                          program_invocation_short_name);
+        }
+        if (log_prefix_len >= (int) sizeof(log_prefix_text))
+        {
+                log_prefix_len = sizeof(log_prefix_text) - 1;
+        }
+}
+
+/**
+ * Copies data to the end of the ring.  The caller makes sure there is
+ * room for it.
+ */
+static void log_append(const char* data, unsigned int len)
+{
+        unsigned int tail = 0;
+        unsigned int first = 0;
+
+        tail = (log_ring_head + log_ring_len) % LOG_RING_SIZE;
+        first = LOG_RING_SIZE - tail < len ? LOG_RING_SIZE - tail : len;
+        memcpy(log_ring + tail, data, first);
+        memcpy(log_ring, data + first, len - first);
+        log_ring_len += len;
 }
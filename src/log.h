@@ -1,9 +1,29 @@
 #ifndef LOG_H
 #define LOG_H
 
-int    log_open    (char* filename);
-int    log_close   ();
+/* Severity levels, most severe first */
+enum {
+        LOG_LEVEL_ERROR,
+        LOG_LEVEL_WARNING,
+        LOG_LEVEL_INFO,
+        LOG_LEVEL_DEBUG,
+};
 
-void   log_error   (char* frmt, ...);
+int    log_open        (char* filename);
+int    log_close       ();
+int    log_set_level   (const char* name);
+
+void   log_message     (int level, char* frmt, ...)
+        __attribute__((format(printf, 2, 3)));
+void   log_error       (char* frmt, ...)
+        __attribute__((format(printf, 1, 2)));
+void   log_warning     (char* frmt, ...)
+        __attribute__((format(printf, 1, 2)));
+void   log_info        (char* frmt, ...)
+        __attribute__((format(printf, 1, 2)));
+
+void   log_flush       ();
+void   log_tick        ();
+int    log_pending     ();
 
 #endif //LOG_H
@@ -0,0 +1,360 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "output.h"
+#include "stats.h"
+#include "log.h"
+
+static int   output_store   (output* out,
+                             buffer* buf,
+                             const struct iovec* iov,
+                             int niov);
+
+/**
+ * Creates a new output.
+ *
+ * @param   fd       File descriptor to write to, e.g. 1 for stdout
+ * @param   prefix   Text in front of every frame, copied, or NULL
+ * @param   suffix   Text after every frame, copied, or NULL
+ * @return  A newly allocated output or NULL if there was not enough
+ *          memory to allocate one.
+ */
+output*
+output_new(int fd, const char* prefix, const char* suffix)
+{
+        output* out = (output*) malloc(sizeof(output));
+        struct stat st;
+        int flags = 0;
+
+        if (out)
+        {
+                out->fd = fd;
+                prefix = prefix ? prefix : "";
+                suffix = suffix ? suffix : "";
+                out->prefix_len = strlen(prefix);
+                out->suffix_len = strlen(suffix) + 1;
+                out->prefix = strdup(prefix);
+                out->suffix = (char*) malloc(out->suffix_len);
+                out->pending = buffer_new();
+                out->written = 0;
+                out->slot = buffer_new();
+                out->flags = -1;
+                if (!out->prefix || !out->suffix || !out->pending || !out->slot)
+                {
+                        output_free(out);
+                        return NULL;
+                }
+                memcpy(out->suffix, suffix, out->suffix_len - 1);
+                out->suffix[out->suffix_len - 1] = '\n';
+
+                /* only pipes and sockets can stall for long */
+                if (fstat(fd, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)))
+                {
+                        flags = fcntl(fd, F_GETFL);
+                        if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+                        {
+                                log_error("Error making output non-blocking: %d", errno);
+                        }
+                        else
+                        {
+                                out->flags = flags;
+                        }
+                }
+        }
+        return out;
+}
+
+/**
+ * Frees the output, but does not close the file descriptor.
+ *
+ * Lines not written yet are written first, blocking if need be, and the
+ * file descriptor is made blocking again.
+ */
+void
+output_free(output* out)
+{
+        if (out)
+        {
+                if (out->flags != -1)
+                {
+                        fcntl(out->fd, F_SETFL, out->flags);
+                }
+                if (out->pending && out->slot && output_busy(out))
+                {
+                        output_flush(out);
+                }
+                free(out->prefix);
+                free(out->suffix);
+                buffer_free(out->pending);
+                buffer_free(out->slot);
+                free(out);
+        }
+}
+
+/**
+ * Replaces the prefix and the suffix of the frames written from now on.
+ *
+ * A line pending or waiting in the slot keeps the prefix and suffix it
+ * was written with, and the file descriptor is left as it is.
+ *
+ * @param   prefix   Text in front of every frame, copied, or NULL
+ * @param   suffix   Text after every frame, copied, or NULL
+ * @return  Zero on success, ENOMEM if there was not enough memory, in
+ *          which case the old prefix and suffix are kept.
+ */
+int
+output_set_affixes(output* out, const char* prefix, const char* suffix)
+{
+        char* new_prefix = NULL;
+        char* new_suffix = NULL;
+        size_t suffix_len = 0;
+
+        prefix = prefix ? prefix : "";
+        suffix = suffix ? suffix : "";
+        suffix_len = strlen(suffix) + 1;
+        new_prefix = strdup(prefix);
+        new_suffix = (char*) malloc(suffix_len);
+        if (!new_prefix || !new_suffix)
+        {
+                free(new_prefix);
+                free(new_suffix);
+                return ENOMEM;
+        }
+        memcpy(new_suffix, suffix, suffix_len - 1);
+        new_suffix[suffix_len - 1] = '\n';
+
+        free(out->prefix);
+        free(out->suffix);
+        out->prefix = new_prefix;
+        out->prefix_len = strlen(new_prefix);
+        out->suffix = new_suffix;
+        out->suffix_len = suffix_len;
+        return 0;
+}
+
+/**
+ * Writes a frame as one line.
+ *
+ * Partial writes are continued and interrupted writes restarted.  If the
+ * output would block, the rest of the line is left pending, or if none of
+ * it was written, the frame waits in the slot, replacing any older frame
+ * there.  Either way, output_flush() writes it later.
+ *
+ * @param   frame   The frame, without newline
+ * @param   len     Length of the frame
+ * @return  Zero on success (even if the line is not written yet), errno
+ *          on failure.
+ */
+int
+output_write(output* out, const char* frame, size_t len)
+{
+        struct iovec part;
+
+        part.iov_base = (void*) frame;
+        part.iov_len  = len;
+        return output_writev(out, &part, 1);
+}
+
+/**
+ * Writes a frame made of parts as one line, like output_write().
+ *
+ * @param   parts    Parts of the frame, without newline
+ * @param   nparts   Number of parts, at most OUTPUT_MAX_PARTS
+ * @return  Zero on success (even if the line is not written yet), errno
+ *          on failure.
+ */
+int
+output_writev(output* out, const struct iovec* parts, int nparts)
+{
+        struct iovec iov[OUTPUT_MAX_PARTS + 2];
+        struct iovec* next = iov;
+        int niov = nparts + 2;
+        ssize_t bytes = 0;
+        size_t sent = 0;
+        buffer* buf = NULL;
+        int err = 0;
+
+        iov[0].iov_base = out->prefix;
+        iov[0].iov_len  = out->prefix_len;
+        memcpy(iov + 1, parts, nparts * sizeof(struct iovec));
+        iov[niov - 1].iov_base = out->suffix;
+        iov[niov - 1].iov_len  = out->suffix_len;
+
+        stats_add(STATS_FRAMES, 1);
+
+        /* older lines go first */
+        err = output_flush(out);
+        if (err)
+        {
+                return err;
+        }
+        if (out->pending->len)
+        {
+                /* a pending line not started yet can be replaced, too */
+                buf = out->written ? out->slot : out->pending;
+                if (buf->len)
+                {
+                        stats_add(STATS_COALESCED, 1);
+                }
+                stats_add(STATS_DEFERRED, 1);
+                return output_store(out, buf, iov, niov);
+        }
+
+        while (niov)
+        {
+                bytes = writev(out->fd, next, niov);
+                stats_add(STATS_WRITES, 1);
+                if (bytes == -1)
+                {
+                        err = errno;
+                        if (err == EINTR)
+                        {
+                                continue;
+                        }
+                        if (err == EAGAIN || err == EWOULDBLOCK)
+                        {
+                                /* the rest of a started line must follow
+                                 * it, a line not started can wait */
+                                if (sent)
+                                {
+                                        return output_store(out, out->pending, next, niov);
+                                }
+                                stats_add(STATS_DEFERRED, 1);
+                                return output_store(out, out->slot, next, niov);
+                        }
+                        log_error("Error writing output: %d", err);
+                        return err;
+                }
+                stats_add(STATS_BYTES, bytes);
+                sent += bytes;
+
+                /* skip what was written */
+                while (niov && (size_t) bytes >= next->iov_len)
+                {
+                        bytes -= next->iov_len;
+                        next++;
+                        niov--;
+                }
+                if (niov)
+                {
+                        next->iov_base = (char*) next->iov_base + bytes;
+                        next->iov_len -= bytes;
+                }
+        }
+
+        return 0;
+}
+
+/**
+ * Writes the pending line and then the line in the slot, as far as
+ * possible without blocking.
+ *
+ * @return  Zero on success (even if something is still not written),
+ *          errno on failure.
+ */
+int
+output_flush(output* out)
+{
+        buffer* tmp = NULL;
+        ssize_t bytes = 0;
+        int err = 0;
+
+        while (1)
+        {
+                if (!out->pending->len)
+                {
+                        if (!out->slot->len)
+                        {
+                                break;
+                        }
+                        /* the line in the slot is next */
+                        tmp = out->pending;
+                        out->pending = out->slot;
+                        out->slot = tmp;
+                        out->written = 0;
+                }
+
+                bytes = write(out->fd, out->pending->buf + out->written,
+                              out->pending->len - out->written);
+                stats_add(STATS_WRITES, 1);
+                if (bytes == -1)
+                {
+                        err = errno;
+                        if (err == EINTR)
+                        {
+                                continue;
+                        }
+                        if (err == EAGAIN || err == EWOULDBLOCK)
+                        {
+                                return 0;
+                        }
+                        log_error("Error writing output: %d", err);
+                        return err;
+                }
+                stats_add(STATS_BYTES, bytes);
+
+                out->written += bytes;
+                if (out->written == out->pending->len)
+                {
+                        out->pending->len = 0;
+                        out->written = 0;
+                }
+        }
+
+        return 0;
+}
+
+/**
+ * Checks whether there is something left to write.
+ *
+ * @return  Non-zero if output_flush() should be called when the output
+ *          can be written to, zero otherwise.
+ */
+int
+output_busy(const output* out)
+{
+        return out->pending->len || out->slot->len;
+}
+
+/**
+ * Copies the rest of a line into the buffer, replacing its contents.
+ *
+ * @return  Zero on success, ENOMEM if memory allocation failed.
+ */
+static int
+output_store(output* out, buffer* buf, const struct iovec* iov, int niov)
+{
+        unsigned int len = 0;
+        char* tmp = NULL;
+        int i = 0;
+
+        for (i = 0; i < niov; i++)
+        {
+                len += iov[i].iov_len;
+        }
+        if (buf->max < len)
+        {
+                tmp = (char*) realloc(buf->buf, len);
+                if (!tmp)
+                {
+                        log_error("Error allocating space for output: %d", ENOMEM);
+                        return ENOMEM;
+                }
+                buf->buf = tmp;
+                buf->max = len;
+        }
+        for (buf->len = 0, i = 0; i < niov; i++)
+        {
+                memcpy(buf->buf + buf->len, iov[i].iov_base, iov[i].iov_len);
+                buf->len += iov[i].iov_len;
+        }
+        if (buf == out->pending)
+        {
+                out->written = 0;
+        }
+        return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <sys/uio.h>
+
+#include "buffer.h"
+
+/** Maximum number of parts in a frame, see output_writev() */
+#define OUTPUT_MAX_PARTS 2
+
+/**
+ * Structure to represent the line oriented output of a bar, e.g. stdout.
+ *
+ * Each frame is written as one line, with a prefix and a suffix that are
+ * set up front.  The prefix, the frame, and the suffix with the newline
+ * are handed to a single writev(2).
+ *
+ * If the output is a pipe or a socket, it is made non-blocking, so that a
+ * slow consumer can not stall the program.  A line that could only be
+ * partly written is kept as pending, and finished before anything else
+ * is written.  A frame that could not be written at all waits in a slot
+ * of one frame, where a newer frame replaces it.
+ */
+typedef struct output output;
+struct output {
+        /** File descriptor to write to */
+        int fd;
+        /** Text in front of every frame, possibly empty */
+        char* prefix;
+        /** Length of the prefix */
+        size_t prefix_len;
+        /** Text after every frame, including the newline */
+        char* suffix;
+        /** Length of the suffix, including the newline */
+        size_t suffix_len;
+        /** Line being written */
+        buffer* pending;
+        /** Number of bytes of the pending line already written */
+        unsigned int written;
+        /** Line waiting for the pending line to be written, or empty */
+        buffer* slot;
+        /** File status flags before the output was made non-blocking, or
+         * -1 if they were not changed */
+        int flags;
+};
+
+output*   output_new     (int fd,
+                          const char* prefix,
+                          const char* suffix);
+void      output_free    (output* out);
+
+int       output_set_affixes (output* out,
+                              const char* prefix,
+                              const char* suffix);
+
+int       output_write   (output* out,
+                          const char* frame,
+                          size_t len);
+int       output_writev  (output* out,
+                          const struct iovec* parts,
+                          int nparts);
+int       output_flush   (output* out);
+int       output_busy    (const output* out);
+
+#endif //OUTPUT_H
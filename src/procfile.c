@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "procfile.h"
+#include "log.h"
+
+static int   procfile_open    (procfile* file);
+static void  procfile_close   (procfile* file);
+static int   procfile_pread   (procfile* file,
+                               buffer* buf);
+
+/**
+ * Creates a new procfile.
+ *
+ * The file is not opened until it is read for the first time.
+ *
+ * @param   path   Path to the file, e.g. "/proc/stat"
+ * @return  A newly allocated procfile or NULL if there was not enought
+ *          memory to allocate one.
+ */
+procfile*
+procfile_new(const char* path)
+{
+        procfile* file = (procfile*) malloc(sizeof(procfile));
+        if (file)
+        {
+                file->fd = -1;
+                file->path = strdup(path);
+                if (!file->path)
+                {
+                        free(file);
+                        file = NULL;
+                }
+        }
+        return file;
+}
+
+/**
+ * Closes the file and frees the procfile.
+ */
+void
+procfile_free(procfile* file)
+{
+        if (file)
+        {
+                procfile_close(file);
+                if (file->path)
+                {
+                        free(file->path);
+                }
+                free(file);
+        }
+}
+
+/**
+ * Reads the whole file into @buf.
+ *
+ * Existing contents of the buffer are discarded, but the space is reused.
+ *
+ * If the file can not be read using the old file descriptor (or reads as
+ * empty), it is assumed to be stale, and the file is reopened once.
+ *
+ * @param   file   File to read
+ * @param   buf    On return, contains the file contents
+ * @return  Zero on success, errno on failure.
+ */
+int
+procfile_read(procfile* file, buffer* buf)
+{
+        int err = 0;
+        int retry = 1;
+
+        do
+        {
+                if (file->fd == -1)
+                {
+                        err = procfile_open(file);
+                        if (err)
+                        {
+                                break;
+                        }
+                        retry = 0;
+                }
+
+                err = procfile_pread(file, buf);
+                if ((err || buf->len == 0) && retry)
+                {
+                        /* stale file descriptor, try once more */
+                        procfile_close(file);
+                        continue;
+                }
+                break;
+        }
+        while (1);
+
+        return err;
+}
+
+/**
+ * Opens the file.
+ *
+ * @return  Zero on success, errno on failure.
+ */
+static int
+procfile_open(procfile* file)
+{
+        int err = 0;
+
+        file->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+        if (file->fd == -1)
+        {
+                err = errno;
+                log_error("Error opening file: %d", err);
+        }
+        return err;
+}
+
+/**
+ * Closes the file, if open.
+ */
+static void
+procfile_close(procfile* file)
+{
+        if (file->fd != -1)
+        {
+                if (close(file->fd) == -1)
+                {
+                        log_error("Error closing file: %d", errno);
+                }
+                file->fd = -1;
+        }
+}
+
+/**
+ * Reads the file from the beginning, using the current file descriptor.
+ *
+ * @return  Zero on success, errno on failure.
+ */
+static int
+procfile_pread(procfile* file, buffer* buf)
+{
+        int err = 0;
+        ssize_t bytes = -1;
+        char* tmp = NULL;
+
+        /* reuse all the space */
+        buf->len = 0;
+
+        while (!err && bytes != 0)
+        {
+                if (buf->len == buf->max)
+                {
+                        tmp = realloc(buf->buf, buf->max + 1024);
+                        if (!tmp)
+                        {
+                                err = errno;
+                                log_error("Error allocating space for file contents: %d", err);
+                                break;
+                        }
+                        buf->buf = tmp;
+                        buf->max += 1024;
+                }
+                bytes = pread(file->fd, buf->buf + buf->len, buf->max - buf->len, buf->len);
+                switch (bytes)
+                {
+                case -1:
+                        err = errno;
+                        if (err == EINTR)
+                        {
+                                err = 0;
+                                bytes = -1;
+                        }
+                        else
+                        {
+                                log_error("Error reading file: %d", err);
+                        }
+                        break;
+                default:
+                        buf->len += bytes;
+                        break;
+                }
+        }
+
+        return err;
+}
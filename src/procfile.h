@@ -0,0 +1,27 @@
+#ifndef PROCFILE_H
+#define PROCFILE_H
+
+#include "buffer.h"
+
+/**
+ * Structure to represent a file that is read over and over again,
+ * e.g. /proc/stat.
+ *
+ * The file is kept open between reads and re-read from the beginning
+ * with pread(2).
+ */
+typedef struct procfile procfile;
+struct procfile {
+        /** Path to the file */
+        char* path;
+        /** File descriptor, or -1 if the file is not open */
+        int fd;
+};
+
+procfile*   procfile_new    (const char* path);
+void        procfile_free   (procfile* file);
+
+int         procfile_read   (procfile* file,
+                             buffer* buf);
+
+#endif //PROCFILE_H
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+#include "log.h"
+
+/* Names of the counters, in the order of the enum */
+static const char* const stats_names[STATS_NCOUNTERS] = {
+        "frames",
+        "writes",
+        "bytes",
+        "deferred",
+        "coalesced",
+        "missed_ticks",
+        "wakeups",
+        "cache_hits",
+        "cache_misses",
+};
+
+/* Names of the stages, in the order of the enum */
+static const char* const stats_stage_names[STATS_NSTAGES] = {
+        "read",
+        "parse",
+        "widths",
+        "format",
+        "write",
+};
+
+static unsigned long stats_counters[STATS_NCOUNTERS];
+
+/* Wall time spent in each stage, in nanoseconds */
+static unsigned long long stats_stage_wall[STATS_NSTAGES];
+
+/* Latency histograms have log-linear buckets: below 2^STATS_SUB_BITS
+ * nanoseconds, one bucket per nanosecond, and above that, 2^STATS_SUB_BITS
+ * buckets for each power of two.  So a bucket is at most 1/8 of its
+ * value wide, and the buckets cover any 64 bit value. */
+#define STATS_SUB_BITS 3
+#define STATS_SUB (1 << STATS_SUB_BITS)
+#define STATS_NBUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB)
+
+/* Latency histogram, count, and maximum of each stage, in nanoseconds */
+static unsigned int stats_histograms[STATS_NSTAGES][STATS_NBUCKETS];
+static unsigned long stats_stage_count[STATS_NSTAGES];
+static unsigned long long stats_stage_max[STATS_NSTAGES];
+
+static unsigned int         stats_bucket         (unsigned long long value);
+static unsigned long long   stats_bucket_limit   (unsigned int bucket);
+static unsigned long long   stats_percentile     (stats_stage stage,
+                                                  unsigned int percent);
+
+/* When the counters were reset */
+static struct timespec stats_start;
+
+/**
+ * Resets all the counters to zero, and starts measuring the rates from
+ * now.
+ */
+void
+stats_reset()
+{
+        memset(stats_counters, 0, sizeof(stats_counters));
+        memset(stats_stage_wall, 0, sizeof(stats_stage_wall));
+        memset(stats_histograms, 0, sizeof(stats_histograms));
+        memset(stats_stage_count, 0, sizeof(stats_stage_count));
+        memset(stats_stage_max, 0, sizeof(stats_stage_max));
+        clock_gettime(CLOCK_MONOTONIC, &stats_start);
+}
+
+/**
+ * Adds @value to the counter.
+ */
+void
+stats_add(stats_counter counter, unsigned long value)
+{
+        stats_counters[counter] += value;
+}
+
+/**
+ * Returns the value of the counter.
+ */
+unsigned long
+stats_get(stats_counter counter)
+{
+        return stats_counters[counter];
+}
+
+/**
+ * Starts timing a stage.
+ */
+void
+stats_timer_start(stats_timer* timer)
+{
+        clock_gettime(CLOCK_MONOTONIC, &timer->wall);
+}
+
+/**
+ * Stops timing a stage, adds the wall time since stats_timer_start() to
+ * the stage, and records it in the histogram of the stage.
+ *
+ * The monotonic clock is read without a system call, and nothing is
+ * allocated or locked, so this is cheap enough for every stage of every
+ * tick.
+ */
+void
+stats_timer_stop(stats_timer* timer, stats_stage stage)
+{
+        struct timespec wall;
+        unsigned long long latency = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &wall);
+        latency = (wall.tv_sec - timer->wall.tv_sec) * 1000000000ULL
+                + wall.tv_nsec - timer->wall.tv_nsec;
+        stats_stage_wall[stage] += latency;
+
+        stats_histograms[stage][stats_bucket(latency)]++;
+        stats_stage_count[stage]++;
+        if (latency > stats_stage_max[stage])
+        {
+                stats_stage_max[stage] = latency;
+        }
+}
+
+/**
+ * Returns the CPU time used by the process, user and system, in
+ * nanoseconds.
+ *
+ * Reading the CPU clock is a system call, so this is called once per
+ * tick, not per stage.
+ */
+unsigned long long
+stats_cpu_time()
+{
+        struct timespec cpu;
+
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+        return cpu.tv_sec * 1000000000ULL + cpu.tv_nsec;
+}
+
+/**
+ * Writes all the counters to the log, on one line, followed by the
+ * wakeups per minute since the counters were reset.
+ *
+ * The wall time spent in each stage, and the share of the wall time the
+ * process has used the CPU, are written on another line.  Then the latencies of each stage are written, one line per
+ * stage that has been timed.
+ */
+void
+stats_log()
+{
+        char line[512];
+        struct timespec now;
+        unsigned long long elapsed = 0;
+        int len = 0;
+        unsigned int i = 0;
+
+        for (i = 0; i < STATS_NCOUNTERS && len < (int) sizeof(line); i++)
+        {
+                len += snprintf(line + len, sizeof(line) - len, "%s%s=%lu",
+                                i ? " " : "", stats_names[i], stats_counters[i]);
+        }
+
+        /* milliseconds */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - stats_start.tv_sec) * 1000ULL
+                + (now.tv_nsec - stats_start.tv_nsec) / 1000000;
+        if (elapsed && len < (int) sizeof(line))
+        {
+                snprintf(line + len, sizeof(line) - len, " wakeups_per_minute=%.1f",
+                         stats_counters[STATS_WAKEUPS] * 60000.0 / elapsed);
+        }
+        log_info("Counters: %s", line);
+
+        len = 0;
+        for (i = 0; i < STATS_NSTAGES && len < (int) sizeof(line); i++)
+        {
+                len += snprintf(line + len, sizeof(line) - len, "%s=%lluus ",
+                                stats_stage_names[i], stats_stage_wall[i] / 1000);
+        }
+        if (elapsed && len < (int) sizeof(line))
+        {
+                snprintf(line + len, sizeof(line) - len, "cpu=%.4f%%",
+                         stats_cpu_time() / (elapsed * 10000.0));
+        }
+        log_info("Overhead: %s", line);
+
+        for (i = 0; i < STATS_NSTAGES; i++)
+        {
+                if (stats_stage_count[i])
+                {
+                        log_info("Latency: %s count=%lu p50=%.1fus p99=%.1fus max=%.1fus",
+                                  stats_stage_names[i], stats_stage_count[i],
+                                  stats_percentile(i, 50) / 1000.0,
+                                  stats_percentile(i, 99) / 1000.0,
+                                  stats_stage_max[i] / 1000.0);
+                }
+        }
+}
+
+/**
+ * Finds the histogram bucket of a value.
+ */
+static unsigned int
+stats_bucket(unsigned long long value)
+{
+        unsigned int msb = 0;
+
+        if (value < STATS_SUB)
+        {
+                return value;
+        }
+        msb = 63 - __builtin_clzll(value);
+        return (msb - STATS_SUB_BITS + 1) * STATS_SUB
+                + ((value >> (msb - STATS_SUB_BITS)) & (STATS_SUB - 1));
+}
+
+/**
+ * Returns the largest value in a histogram bucket.
+ */
+static unsigned long long
+stats_bucket_limit(unsigned int bucket)
+{
+        unsigned int shift = 0;
+
+        if (bucket < STATS_SUB)
+        {
+                return bucket;
+        }
+        shift = bucket / STATS_SUB - 1;
+        return ((unsigned long long) (STATS_SUB + bucket % STATS_SUB) << shift)
+                + ((1ULL << shift) - 1);
+}
+
+/**
+ * Estimates a percentile of the latency of a stage, as the upper limit of
+ * the bucket it falls in, but no more than the maximum.
+ *
+ * @param   percent   Percentile, e.g. 99
+ * @return  Latency in nanoseconds.
+ */
+static unsigned long long
+stats_percentile(stats_stage stage, unsigned int percent)
+{
+        unsigned long long rank = 0;
+        unsigned long long seen = 0;
+        unsigned long long limit = 0;
+        unsigned int i = 0;
+
+        /* The smallest latency with at least percent % at or below it */
+        rank = (stats_stage_count[stage] * percent + 99) / 100;
+        for (i = 0; i < STATS_NBUCKETS; i++)
+        {
+                seen += stats_histograms[stage][i];
+                if (seen >= rank)
+                {
+                        break;
+                }
+        }
+        limit = stats_bucket_limit(i);
+        return limit < stats_stage_max[stage] ? limit : stats_stage_max[stage];
+}
@@ -0,0 +1,72 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <time.h>
+
+/**
+ * Counters of what the program has done, for checking the cost of a frame
+ * from the outside.
+ */
+typedef enum stats_counter stats_counter;
+enum stats_counter {
+        /** Frames handed to the output */
+        STATS_FRAMES,
+        /** Write system calls on the output */
+        STATS_WRITES,
+        /** Bytes written to the output */
+        STATS_BYTES,
+        /** Frames that had to wait because the output was not writable */
+        STATS_DEFERRED,
+        /** Waiting frames replaced by a newer frame, never written */
+        STATS_COALESCED,
+        /** Ticks that passed while the program was busy */
+        STATS_MISSED_TICKS,
+        /** Times the event loop woke up */
+        STATS_WAKEUPS,
+        /** Frames copied from the frame cache */
+        STATS_CACHE_HITS,
+        /** Frames rendered because they were not in the frame cache */
+        STATS_CACHE_MISSES,
+        /** Number of counters */
+        STATS_NCOUNTERS
+};
+
+/**
+ * Stages of producing a frame, timed separately.  The latency of each
+ * stage is also kept in a histogram.
+ */
+typedef enum stats_stage stats_stage;
+enum stats_stage {
+        /** Reading the source file */
+        STATS_READ,
+        /** Parsing the source file */
+        STATS_PARSE,
+        /** Setting the section widths */
+        STATS_WIDTHS,
+        /** Textualizing the bar */
+        STATS_FORMAT,
+        /** Writing the output */
+        STATS_WRITE,
+        /** Number of stages */
+        STATS_NSTAGES
+};
+
+/**
+ * Start of a timed stage, in wall time.
+ */
+typedef struct stats_timer stats_timer;
+struct stats_timer {
+        struct timespec wall;
+};
+
+void                 stats_reset        ();
+void                 stats_add          (stats_counter counter,
+                                         unsigned long value);
+unsigned long        stats_get          (stats_counter counter);
+void                 stats_timer_start  (stats_timer* timer);
+void                 stats_timer_stop   (stats_timer* timer,
+                                         stats_stage stage);
+unsigned long long   stats_cpu_time     ();
+void                 stats_log          ();
+
+#endif //STATS_H
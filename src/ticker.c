@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "ticker.h"
+#include "stats.h"
+#include "log.h"
+
+/**
+ * Creates a new ticker and starts it.  The first tick is one interval
+ * from now.
+ *
+ * @param   interval   Interval in milliseconds, non-zero
+ * @return  A newly allocated ticker or NULL on failure.
+ */
+ticker*
+ticker_new(unsigned int interval)
+{
+        ticker* tick = (ticker*) malloc(sizeof(ticker));
+
+        if (tick)
+        {
+                tick->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+                if (tick->fd == -1)
+                {
+                        log_error("Error creating timer: %d", errno);
+                        free(tick);
+                        return NULL;
+                }
+
+                if (ticker_set_interval(tick, interval))
+                {
+                        ticker_free(tick);
+                        return NULL;
+                }
+        }
+        return tick;
+}
+
+/**
+ * Changes the interval of the ticker.  The next tick is one new interval
+ * from now.
+ *
+ * @param   interval   Interval in milliseconds, non-zero
+ * @return  Zero on success, errno on failure.
+ */
+int
+ticker_set_interval(ticker* tick, unsigned int interval)
+{
+        struct itimerspec spec;
+        int err = 0;
+
+        spec.it_interval.tv_sec  = interval / 1000;
+        spec.it_interval.tv_nsec = interval % 1000 * 1000000L;
+        clock_gettime(CLOCK_MONOTONIC, &spec.it_value);
+        spec.it_value.tv_sec  += spec.it_interval.tv_sec;
+        spec.it_value.tv_nsec += spec.it_interval.tv_nsec;
+        if (spec.it_value.tv_nsec >= 1000000000L)
+        {
+                spec.it_value.tv_sec++;
+                spec.it_value.tv_nsec -= 1000000000L;
+        }
+        if (timerfd_settime(tick->fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+        {
+                err = errno;
+                log_error("Error starting timer: %d", err);
+                return err;
+        }
+        tick->interval = interval;
+        return 0;
+}
+
+/**
+ * Stops and frees the ticker.
+ */
+void
+ticker_free(ticker* tick)
+{
+        if (tick)
+        {
+                close(tick->fd);
+                free(tick);
+        }
+}
+
+/**
+ * Waits for the next tick.
+ *
+ * If more than one tick has passed since the last call, the extra ticks
+ * are counted as missed.
+ *
+ * @return  Zero on success, errno on failure.
+ */
+int
+ticker_wait(ticker* tick)
+{
+        uint64_t expirations = 0;
+        ssize_t bytes = 0;
+        int err = 0;
+
+        do
+        {
+                bytes = read(tick->fd, &expirations, sizeof(expirations));
+        }
+        while (bytes == -1 && errno == EINTR);
+
+        if (bytes != sizeof(expirations))
+        {
+                err = bytes == -1 ? errno : EIO;
+                log_error("Error waiting for timer: %d", err);
+                return err;
+        }
+
+        if (expirations > 1)
+        {
+                stats_add(STATS_MISSED_TICKS, expirations - 1);
+        }
+        return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef TICKER_H
+#define TICKER_H
+
+/**
+ * Structure to represent a periodic tick, e.g. the polling interval.
+ *
+ * Ticks are scheduled against absolute CLOCK_MONOTONIC deadlines, so the
+ * time spent between the ticks does not make them drift.  Ticks that
+ * pass while the program is busy are counted as missed, not made up for.
+ */
+typedef struct ticker ticker;
+struct ticker {
+        /** Timer file descriptor */
+        int fd;
+        /** Interval in milliseconds */
+        unsigned int interval;
+};
+
+ticker*   ticker_new            (unsigned int interval);
+void      ticker_free           (ticker* tick);
+
+int       ticker_set_interval   (ticker* tick,
+                                 unsigned int interval);
+int       ticker_wait           (ticker* tick);
+
+#endif //TICKER_H
@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "window.h"
+
+static void window_settle(unsigned int* values,
+                          unsigned int nvalues,
+                          unsigned int fill);
+
+/**
+ * Creates a new, empty window.
+ *
+ * @param   size        Number of samples in the window, non-zero
+ * @param   nvalues     Number of values per sample
+ * @param   aggregate   How to combine the samples, e.g. WINDOW_MEAN
+ * @return  A newly allocated window or NULL on failure.
+ */
+window*
+window_new(unsigned int size, unsigned int nvalues, int aggregate)
+{
+        window* win = (window*) malloc(sizeof(window));
+
+        if (win)
+        {
+                win->size = size;
+                win->nvalues = nvalues + 1;
+                win->len = 0;
+                win->next = 0;
+                win->aggregate = aggregate;
+                /* The usual EMA weight for N samples, 2 / (N + 1) */
+                win->alpha = 2 * WINDOW_ONE / (size + 1);
+                win->samples = (unsigned int*) malloc(size * win->nvalues * sizeof(unsigned int));
+                win->sums = (unsigned long long*) calloc(win->nvalues, sizeof(unsigned long long));
+                win->ema = (unsigned int*) calloc(win->nvalues, sizeof(unsigned int));
+                win->result = (unsigned int*) calloc(win->nvalues, sizeof(unsigned int));
+                if (!win->samples || !win->sums || !win->ema || !win->result)
+                {
+                        window_free(win);
+                        return NULL;
+                }
+        }
+        return win;
+}
+
+/**
+ * Frees the window.
+ */
+void
+window_free(window* win)
+{
+        if (win)
+        {
+                free(win->samples);
+                free(win->sums);
+                free(win->ema);
+                free(win->result);
+                free(win);
+        }
+}
+
+/**
+ * Adds a sample to the window, replacing the oldest one if the window
+ * is full.
+ *
+ * @param   total    Total value, zero for an empty sample
+ * @param   values   Values, nvalues of them
+ */
+void
+window_add(window* win, unsigned int total, const unsigned int* values)
+{
+        const unsigned int n = win->nvalues - 1;
+        unsigned int* sample = win->samples + win->next * win->nvalues;
+        unsigned long long sum = 0;
+        unsigned int i = 0;
+
+        if (win->len == win->size)
+        {
+                for (i = 0; i <= n; i++)
+                {
+                        win->sums[i] -= sample[i];
+                }
+        }
+        else
+        {
+                win->len++;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+                sample[i] = total && values[i] < total
+                        ? (unsigned long long) values[i] * WINDOW_ONE / total
+                        : total ? WINDOW_ONE : 0;
+                sum += values[i];
+        }
+        sample[n] = total && sum < total ? sum * WINDOW_ONE / total : total ? WINDOW_ONE : 0;
+        window_settle(sample, n, sample[n]);
+
+        for (i = 0; i <= n; i++)
+        {
+                win->sums[i] += sample[i];
+                win->ema[i] = win->len == 1
+                        ? sample[i]
+                        : ((unsigned long long) win->ema[i] * (WINDOW_ONE - win->alpha)
+                           + (unsigned long long) sample[i] * win->alpha
+                           + WINDOW_ONE / 2) / WINDOW_ONE;
+        }
+
+        win->next = (win->next + 1) % win->size;
+}
+
+/**
+ * Combines the samples in the window.
+ *
+ * @return  The combined values as fractions of WINDOW_ONE, valid until
+ *          the next call.  All zeros if the window is empty.
+ */
+const unsigned int*
+window_aggregate(window* win)
+{
+        const unsigned int n = win->nvalues - 1;
+        const unsigned int* sample = NULL;
+        unsigned int i = 0;
+        unsigned int j = 0;
+
+        memset(win->result, 0, win->nvalues * sizeof(unsigned int));
+        if (!win->len)
+        {
+                return win->result;
+        }
+
+        switch (win->aggregate)
+        {
+        case WINDOW_EMA:
+                memcpy(win->result, win->ema, win->nvalues * sizeof(unsigned int));
+                break;
+        case WINDOW_MAX:
+                for (j = 0; j < win->len; j++)
+                {
+                        sample = win->samples + j * win->nvalues;
+                        for (i = 0; i <= n; i++)
+                        {
+                                if (sample[i] > win->result[i])
+                                {
+                                        win->result[i] = sample[i];
+                                }
+                        }
+                }
+                break;
+        default:
+                for (i = 0; i <= n; i++)
+                {
+                        win->result[i] = win->sums[i] / win->len;
+                }
+                break;
+        }
+
+        window_settle(win->result, n, win->result[n]);
+        return win->result;
+}
+
+/**
+ * Gives the fractions lost in rounding to the largest value, so that
+ * values that covered the fill before rounding cover it exactly.
+ *
+ * @param   fill   Fraction the values should cover at least
+ */
+static void
+window_settle(unsigned int* values, unsigned int nvalues, unsigned int fill)
+{
+        unsigned long long sum = 0;
+        unsigned int largest = 0;
+        unsigned int i = 0;
+
+        for (i = 0; i < nvalues; i++)
+        {
+                sum += values[i];
+                if (values[i] > values[largest])
+                {
+                        largest = i;
+                }
+        }
+        if (nvalues && sum < fill)
+        {
+                values[largest] += fill - sum;
+        }
+}
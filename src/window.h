@@ -0,0 +1,59 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+/** Fixed point one, the whole of a bar */
+#define WINDOW_ONE 65536
+
+/* How the samples in a window are combined */
+enum {
+        WINDOW_MEAN,
+        WINDOW_EMA,
+        WINDOW_MAX,
+};
+
+/**
+ * Structure to represent a sliding window of samples.
+ *
+ * Each sample is a set of values and their total, stored as 16.16 fixed
+ * point fractions of the total, so that samples with different totals
+ * can be combined.  One more fraction per sample, the fill, tells how
+ * much of the whole the values cover together.
+ *
+ * The samples are kept in a ring of a fixed size; the oldest sample is
+ * replaced when the ring is full.
+ */
+typedef struct window window;
+struct window {
+        /** Number of samples in the ring */
+        unsigned int size;
+        /** Number of fractions per sample, including the fill */
+        unsigned int nvalues;
+        /** Number of samples stored */
+        unsigned int len;
+        /** Index of the slot for the next sample */
+        unsigned int next;
+        /** WINDOW_MEAN, WINDOW_EMA, or WINDOW_MAX */
+        int aggregate;
+        /** Weight of a new sample in the EMA, fixed point */
+        unsigned int alpha;
+        /** Samples, nvalues fractions each */
+        unsigned int* samples;
+        /** Sum of each fraction over the stored samples */
+        unsigned long long* sums;
+        /** Exponential moving average of each fraction */
+        unsigned int* ema;
+        /** Result of the latest window_aggregate() */
+        unsigned int* result;
+};
+
+window*               window_new         (unsigned int size,
+                                          unsigned int nvalues,
+                                          int aggregate);
+void                  window_free        (window* win);
+
+void                  window_add         (window* win,
+                                          unsigned int total,
+                                          const unsigned int* values);
+const unsigned int*   window_aggregate   (window* win);
+
+#endif //WINDOW_H
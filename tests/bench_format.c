@@ -0,0 +1,67 @@
+/*
+ * Benchmark for gmbar_format().
+ *
+ * Renders a segmented four section bar, the worst case for the number of
+ * dzen2 tokens per frame, and prints the rate in tokens per microsecond.
+ *
+ * Usage: bench_format [frames]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libgmbar.h"
+
+
+int
+main(int argc, char** argv)
+{
+        const unsigned int values[] = { 300, 200, 100, 400 };
+        int frames = argc > 1 ? atoi(argv[1]) : 20000;
+        gmbar* bar = NULL;
+        char* buf = NULL;
+        int len = 0;
+        int max = 0;
+        int tokens = 0;
+        int i = 0;
+        double us = 0;
+        struct timespec start;
+        struct timespec end;
+
+        bar = gmbar_new_with_defaults(1000, 10, "red", "#444444", 4);
+        if (!bar || gmbar_add_sections(bar, 4, "red", "orange", "yellow", "none"))
+        {
+                return 1;
+        }
+        bar->segment_width = 1;
+        bar->segment_gap = 1;
+        for (i = 0; i < 4; i++)
+        {
+                gmbar_set_section_width(&bar->sections[i], 1000, values[i]);
+        }
+
+        if (gmbar_format(bar, &buf, &len, &max) < 0)
+        {
+                return 1;
+        }
+        for (i = 0; i < len; i++)
+        {
+                tokens += buf[i] == '^';
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < frames; i++)
+        {
+                len = 0;
+                gmbar_format(bar, &buf, &len, &max);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+        printf("bench_format: %d bytes, %d tokens per frame, %.2f us per frame, %.1f tokens/us\n",
+               len, tokens, us / frames, tokens * (double) frames / us);
+
+        free(buf);
+        gmbar_free(bar);
+        return 0;
+}
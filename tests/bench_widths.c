@@ -0,0 +1,78 @@
+/*
+ * Benchmark for gmbar_set_section_widths().
+ *
+ * Sets the widths of a four section bar once per section with
+ * gmbar_set_section_width(), and then all at once with
+ * gmbar_set_section_widths(), and prints the time per frame of both.
+ *
+ * Usage: bench_widths [frames]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libgmbar.h"
+
+
+static double   elapsed_ns      (const struct timespec* start,
+                                 const struct timespec* end);
+
+
+int
+main(int argc, char** argv)
+{
+        unsigned int values[] = { 123, 4567, 89, 12345 };
+        int frames = argc > 1 ? atoi(argv[1]) : 2000000;
+        volatile unsigned int sink = 0;
+        unsigned int total = 0;
+        unsigned int j = 0;
+        int i = 0;
+        gmbar* bar = NULL;
+        struct timespec start;
+        struct timespec end;
+
+        bar = gmbar_new_with_defaults(1000, 10, "red", "none", 4);
+        if (!bar || gmbar_add_sections(bar, 4, "red", "orange", "yellow", "none"))
+        {
+                return 1;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < frames; i++)
+        {
+                values[0] = i & 1023;
+                total = values[0] + values[1] + values[2] + values[3];
+                for (j = 0; j < 4; j++)
+                {
+                        gmbar_set_section_width(&bar->sections[j], total, values[j]);
+                }
+                sink += bar->sections[3].width;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("bench_widths: per section: %.1f ns per frame\n",
+               elapsed_ns(&start, &end) / frames);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < frames; i++)
+        {
+                values[0] = i & 1023;
+                total = values[0] + values[1] + values[2] + values[3];
+                gmbar_set_section_widths(bar, total, values);
+                sink += bar->sections[3].width;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("bench_widths: all at once: %.1f ns per frame\n",
+               elapsed_ns(&start, &end) / frames);
+
+        gmbar_free(bar);
+        return 0;
+}
+
+/**
+ * Returns the time between @start and @end in nanoseconds.
+ */
+static double
+elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+        return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
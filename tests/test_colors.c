@@ -0,0 +1,123 @@
+/*
+ * Test for setting bar and section colors.
+ *
+ * The colors are kept in an arena that is replaced when it gets full.
+ * Colors that are already in the bar, and so in the arena, are given
+ * to the setters again and again, so that the arena is replaced while
+ * they are being copied, and the colors must come out intact.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgmbar.h"
+
+/* Number of times each setter is called */
+#define ROUNDS 100
+
+static const char* const colors[] = {
+        "red", "#00ff00", "blue", "light goldenrod yellow",
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+
+static int      check_colors    (const gmbar* bar,
+                                 const char* fg,
+                                 const char* bg,
+                                 unsigned int round);
+
+
+int
+main()
+{
+        gmbar* bar = NULL;
+        unsigned int i = 0;
+        unsigned int round = 0;
+        int failures = 0;
+
+        /* no room reserved for sections, so the arena is full from the
+         * start */
+        bar = gmbar_new_with_defaults(100, 10, "#aaaaaa", "#444444", 0);
+        if (!bar)
+        {
+                return 1;
+        }
+        for (i = 0; i < COUNT(colors); i++)
+        {
+                if (gmbar_add_section(bar, colors[i]))
+                {
+                        return 1;
+                }
+        }
+
+        for (round = 0; round < ROUNDS && !failures; round++)
+        {
+                /* the bar colors, one at a time and both at once */
+                if (gmbar_set_color(bar, bar->color.fg, NULL)
+                    || gmbar_set_color(bar, NULL, bar->color.bg)
+                    || gmbar_set_color(bar, bar->color.fg, bar->color.bg))
+                {
+                        return 1;
+                }
+                /* each section its own color */
+                for (i = 0; i < COUNT(colors); i++)
+                {
+                        if (gmbar_set_section_color(&bar->sections[i], bar->sections[i].color))
+                        {
+                                return 1;
+                        }
+                }
+                failures += check_colors(bar, "#aaaaaa", "#444444", round);
+        }
+
+        /* a bar color from a section, and a new section in the color of
+         * the first one */
+        if (gmbar_set_color(bar, bar->sections[3].color, bar->sections[1].color)
+            || gmbar_add_section(bar, bar->sections[0].color))
+        {
+                return 1;
+        }
+        failures += check_colors(bar, colors[3], colors[1], round);
+        if (strcmp(bar->sections[COUNT(colors)].color, colors[0]) != 0)
+        {
+                fprintf(stderr, "new section: %s, expected %s\n",
+                        bar->sections[COUNT(colors)].color, colors[0]);
+                failures++;
+        }
+
+        printf("test_colors: %u rounds, %d failures\n", round, failures);
+
+        gmbar_free(bar);
+        return failures ? 1 : 0;
+}
+
+/**
+ * Checks that the bar has colors @fg and @bg, and that the sections
+ * have the colors they were added with.
+ *
+ * @return  Number of failures.
+ */
+static int
+check_colors(const gmbar* bar, const char* fg, const char* bg, unsigned int round)
+{
+        unsigned int i = 0;
+        int failures = 0;
+
+        if (strcmp(bar->color.fg, fg) != 0 || strcmp(bar->color.bg, bg) != 0)
+        {
+                fprintf(stderr, "round %u: bar colors %s %s, expected %s %s\n",
+                        round, bar->color.fg, bar->color.bg, fg, bg);
+                failures++;
+        }
+        for (i = 0; i < COUNT(colors); i++)
+        {
+                if (strcmp(bar->sections[i].color, colors[i]) != 0)
+                {
+                        fprintf(stderr, "round %u: section %u is %s, expected %s\n",
+                                round, i, bar->sections[i].color, colors[i]);
+                        failures++;
+                }
+        }
+        return failures;
+}
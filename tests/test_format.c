@@ -0,0 +1,489 @@
+/*
+ * Golden test for gmbar_format().
+ *
+ * Renders bars over the option space (margins, paddings, segments,
+ * granularity, colors and section widths), first narrow bars with three
+ * sections and then wide bars with eight, and compares each frame
+ * against the frame recorded in the golden file.
+ *
+ * The golden file was written by the snprintf() based gmbar_format() of
+ * gmbar 0.4.  The renderer has merged redundant tokens since, so the
+ * frames are not compared byte by byte: both are drawn the way dzen2
+ * draws them, and must give the same pixels and end at the same place.
+ * gmrenderer_format() must give the same frames as gmbar_format().
+ *
+ * Usage: test_format [-w] [golden]
+ *
+ * With -w, the frames are written to the golden file instead.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgmbar.h"
+
+#define GOLDEN "test_format.golden"
+
+/* Size of the canvas the frames are drawn on */
+#define CANVAS_WIDTH 256
+#define CANVAS_HEIGHT 16
+/* Maximum number of colors on a canvas */
+#define CANVAS_COLORS 16
+
+static const gmmargin margins[] = {
+        { 0, 0, 0, 0 },
+        { 1, 0, 1, 0 },
+        { 2, 3, 0, 1 },
+};
+static const gmmargin paddings[] = {
+        { 0, 0, 0, 0 },
+        { 1, 1, 1, 1 },
+        { 0, 2, 3, 1 },
+};
+static const unsigned int segments[][2] = {
+        { 0, 0 },
+        { 1, 1 },
+        { 3, 0 },
+        { 4, 2 },
+};
+static const unsigned int granularities[] = { 0, 4 };
+
+/* Narrow bars: three sections, every margin and padding */
+#define NARROW_SECTIONS 3
+static const char* narrow_colors[][2 + NARROW_SECTIONS] = {
+        /* bar fg, bar bg, sections */
+        { "none",    "none",    "red",     "orange",  "yellow" },
+        { "#aaaaaa", "#444444", "red",     "none",    "red"    },
+        { "red",     "none",    "none",    "none",    "none"   },
+        { "none",    "#444444", "#00ff00", "#00ff00", "blue"   },
+};
+static const unsigned int narrow_values[][NARROW_SECTIONS] = {
+        { 0,   0,   0   },
+        { 100, 0,   0   },
+        { 25,  50,  25  },
+        { 1,   2,   97  },
+        { 10,  20,  30  },
+};
+static const unsigned int narrow_widths[] = { 7, 29 };
+
+/* Wide bars: eight sections, the last margin and padding */
+#define WIDE_SECTIONS 8
+#define WIDE_WIDTH 200
+static const char* wide_colors[][2 + WIDE_SECTIONS] = {
+        { "none",    "none",    "red", "orange", "yellow", "green", "blue", "none",    "red",  "red"  },
+        { "#aaaaaa", "#444444", "red", "red",    "red",    "none",  "none", "#00ff00", "blue", "none" },
+        { "red",     "none",    "none", "none",  "none",   "none",  "none", "none",    "none", "none" },
+};
+static const unsigned int wide_values[][WIDE_SECTIONS] = {
+        { 0,   0,  0,  0,  0,  0,  0,  0   },
+        { 12,  13, 12, 13, 12, 13, 12, 13  },
+        { 1,   2,  3,  5,  8,  13, 21, 34  },
+        { 100, 0,  0,  0,  0,  0,  0,  0   },
+        { 0,   0,  0,  0,  0,  0,  0,  100 },
+        { 30,  0,  30, 0,  30, 0,  10, 0   },
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+/**
+ * Pixels drawn by a frame.
+ */
+typedef struct canvas canvas;
+struct canvas {
+        /** Colors of the pixels, zero for none, otherwise the index of
+         *  the color in @colors plus one */
+        unsigned char pixels[CANVAS_HEIGHT][CANVAS_WIDTH];
+        /** Colors used */
+        char colors[CANVAS_COLORS][16];
+        /** Number of colors used */
+        unsigned int ncolors;
+        /** Position where the frame ended */
+        int x;
+};
+
+#define NARROW_FRAMES (COUNT(margins) * COUNT(paddings) * COUNT(segments) \
+                       * COUNT(granularities) * COUNT(narrow_colors) \
+                       * COUNT(narrow_values) * COUNT(narrow_widths))
+#define WIDE_FRAMES (COUNT(segments) * COUNT(granularities) \
+                     * COUNT(wide_colors) * COUNT(wide_values))
+
+
+static gmbar*   make_bar        (unsigned int n);
+static gmbar*   new_bar         (unsigned int width,
+                                 const char** colors,
+                                 unsigned int nsections,
+                                 const unsigned int* values,
+                                 const gmmargin* margin,
+                                 const gmmargin* padding,
+                                 const unsigned int* segment,
+                                 unsigned int granularity);
+static int      check_frame     (FILE* golden,
+                                 int write,
+                                 unsigned int n,
+                                 const char* frame);
+static int      same_pixels     (const char* a,
+                                 const char* b);
+static int      draw            (canvas* c,
+                                 const char* frame);
+static int      is_token        (const char* name,
+                                 const char* arg,
+                                 const char* str);
+static int      draw_rectangle  (canvas* c,
+                                 unsigned int color,
+                                 const char* size,
+                                 int outline);
+
+
+int
+main(int argc, char** argv)
+{
+        int write = 0;
+        const char* path = GOLDEN;
+        FILE* golden = NULL;
+        gmbar* bar = NULL;
+        gmrenderer* renderer = NULL;
+        char* buf = NULL;
+        int len = 0;
+        int max = 0;
+        unsigned int n = 0;
+        int failures = 0;
+
+        if (argc > 1 && strcmp(argv[1], "-w") == 0)
+        {
+                write = 1;
+                argc--;
+                argv++;
+        }
+        if (argc > 1)
+        {
+                path = argv[1];
+        }
+
+        golden = fopen(path, write ? "w" : "r");
+        if (!golden)
+        {
+                perror(path);
+                return 1;
+        }
+
+        renderer = gmrenderer_new();
+        if (!renderer)
+        {
+                return 1;
+        }
+
+        for (n = 0; n < NARROW_FRAMES + WIDE_FRAMES && failures < 10; n++)
+        {
+                bar = make_bar(n);
+                if (!bar)
+                {
+                        return 1;
+                }
+
+                len = 0;
+                if (gmbar_format(bar, &buf, &len, &max) < 0)
+                {
+                        fprintf(stderr, "%u: gmbar_format() failed\n", n);
+                        return 1;
+                }
+                failures += check_frame(golden, write, n, buf);
+
+                if (gmrenderer_format(renderer, bar) < 0
+                    || strcmp(renderer->buf, buf) != 0)
+                {
+                        fprintf(stderr, "%u: renderer differs: %s\n", n, renderer->buf);
+                        failures++;
+                }
+
+                gmbar_free(bar);
+        }
+
+        free(buf);
+        gmrenderer_free(renderer);
+        fclose(golden);
+
+        if (!write)
+        {
+                printf("test_format: %u frames, %d failures\n", n, failures);
+        }
+        return failures ? 1 : 0;
+}
+
+/**
+ * Creates the bar for configuration @n of the option space.
+ */
+static gmbar*
+make_bar(unsigned int n)
+{
+        const gmmargin* margin = NULL;
+        const gmmargin* padding = NULL;
+        const unsigned int* segment = NULL;
+        unsigned int granularity = 0;
+
+        if (n >= NARROW_FRAMES)
+        {
+                n -= NARROW_FRAMES;
+                segment = segments[n % COUNT(segments)];
+                n /= COUNT(segments);
+                granularity = granularities[n % COUNT(granularities)];
+                n /= COUNT(granularities);
+                return new_bar(WIDE_WIDTH,
+                               wide_colors[n % COUNT(wide_colors)], WIDE_SECTIONS,
+                               wide_values[n / COUNT(wide_colors)],
+                               &margins[COUNT(margins) - 1],
+                               &paddings[COUNT(paddings) - 1],
+                               segment, granularity);
+        }
+
+        margin = &margins[n % COUNT(margins)];
+        n /= COUNT(margins);
+        padding = &paddings[n % COUNT(paddings)];
+        n /= COUNT(paddings);
+        segment = segments[n % COUNT(segments)];
+        n /= COUNT(segments);
+        granularity = granularities[n % COUNT(granularities)];
+        n /= COUNT(granularities);
+        return new_bar(narrow_widths[n / COUNT(narrow_colors) / COUNT(narrow_values)],
+                       narrow_colors[n % COUNT(narrow_colors)], NARROW_SECTIONS,
+                       narrow_values[n / COUNT(narrow_colors) % COUNT(narrow_values)],
+                       margin, padding, segment, granularity);
+}
+
+/**
+ * Creates a bar of @width pixels and @nsections sections, the widths of
+ * which are @values out of 100.
+ *
+ * @param   colors    Foreground and background color of the bar, and
+ *                    the colors of the sections
+ */
+static gmbar*
+new_bar(unsigned int width,
+        const char** colors,
+        unsigned int nsections,
+        const unsigned int* values,
+        const gmmargin* margin,
+        const gmmargin* padding,
+        const unsigned int* segment,
+        unsigned int granularity)
+{
+        unsigned int i = 0;
+        gmbar* bar = gmbar_new_with_defaults(width, 10, colors[0], colors[1], nsections);
+
+        if (!bar)
+        {
+                return NULL;
+        }
+        for (i = 0; i < nsections; i++)
+        {
+                if (gmbar_add_section(bar, colors[2 + i]))
+                {
+                        gmbar_free(bar);
+                        return NULL;
+                }
+        }
+        bar->margin = *margin;
+        bar->padding = *padding;
+        bar->segment_width = segment[0];
+        bar->segment_gap = segment[1];
+        bar->granularity = granularity;
+        for (i = 0; i < nsections; i++)
+        {
+                gmbar_set_section_width(&bar->sections[i], 100, values[i]);
+        }
+
+        return bar;
+}
+
+/**
+ * Writes the frame to the golden file, or compares it against the next
+ * frame in the golden file.
+ *
+ * @return  Zero if the frame draws the same as the golden one, one if
+ *          not.
+ */
+static int
+check_frame(FILE* golden, int write, unsigned int n, const char* frame)
+{
+        char* line = NULL;
+        size_t size = 0;
+        ssize_t len = 0;
+        int failed = 0;
+
+        if (write)
+        {
+                fprintf(golden, "%s\n", frame);
+                return 0;
+        }
+
+        len = getline(&line, &size, golden);
+        if (len > 0 && line[len - 1] == '\n')
+        {
+                line[--len] = '\0';
+        }
+        if (len < 0 || !same_pixels(line, frame))
+        {
+                fprintf(stderr, "%u: expected: %s\n", n, len < 0 ? "(end of file)" : line);
+                fprintf(stderr, "%u: actual:   %s\n", n, frame);
+                failed = 1;
+        }
+        free(line);
+        return failed;
+}
+
+/**
+ * Tells whether frames @a and @b draw the same pixels and end at the
+ * same position.
+ *
+ * @return  Non-zero if they do, zero if not or if either frame could not
+ *          be drawn.
+ */
+static int
+same_pixels(const char* a, const char* b)
+{
+        static canvas ca;
+        static canvas cb;
+        unsigned int x = 0;
+        unsigned int y = 0;
+        unsigned char pa = 0;
+        unsigned char pb = 0;
+
+        if (draw(&ca, a) || draw(&cb, b) || ca.x != cb.x)
+        {
+                return 0;
+        }
+        for (y = 0; y < CANVAS_HEIGHT; y++)
+        {
+                for (x = 0; x < CANVAS_WIDTH; x++)
+                {
+                        pa = ca.pixels[y][x];
+                        pb = cb.pixels[y][x];
+                        if ((pa == 0) != (pb == 0)
+                            || (pa && strcmp(ca.colors[pa - 1], cb.colors[pb - 1]) != 0))
+                        {
+                                return 0;
+                        }
+                }
+        }
+        return 1;
+}
+
+/**
+ * Draws @frame on canvas @c the way dzen2 does: ^p() moves the position,
+ * ^r() and ^ro() draw a rectangle, vertically centered, in the color of
+ * the last ^fg() and move the position past it.  ^ib() does not draw
+ * anything.
+ *
+ * @return  Zero on success, -1 if the frame has an unknown token or
+ *          draws outside the canvas.
+ */
+static int
+draw(canvas* c, const char* frame)
+{
+        const char* p = frame;
+        const char* name = NULL;
+        const char* arg = NULL;
+        const char* end = NULL;
+        unsigned int color = 0;
+        size_t len = 0;
+
+        memset(c, 0, sizeof(canvas));
+        while (*p)
+        {
+                /* every token is ^name(arg) */
+                name = p + 1;
+                arg = *p == '^' ? strchr(name, '(') : NULL;
+                end = arg ? strchr(arg, ')') : NULL;
+                if (!end)
+                {
+                        return -1;
+                }
+                arg++;
+                len = end - arg;
+                p = end + 1;
+
+                if (is_token(name, arg, "fg"))
+                {
+                        for (color = 0; color < c->ncolors; color++)
+                        {
+                                if (strlen(c->colors[color]) == len
+                                    && strncmp(c->colors[color], arg, len) == 0)
+                                {
+                                        break;
+                                }
+                        }
+                        if (color == c->ncolors)
+                        {
+                                if (color == CANVAS_COLORS || len >= sizeof(c->colors[0]))
+                                {
+                                        return -1;
+                                }
+                                memcpy(c->colors[color], arg, len);
+                                c->ncolors++;
+                        }
+                        color++;
+                }
+                else if (is_token(name, arg, "p"))
+                {
+                        c->x += atoi(arg);
+                }
+                else if (is_token(name, arg, "r") || is_token(name, arg, "ro"))
+                {
+                        if (draw_rectangle(c, color, arg, is_token(name, arg, "ro")))
+                        {
+                                return -1;
+                        }
+                }
+                else if (!is_token(name, arg, "ib"))
+                {
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+/**
+ * Tells whether the token name that runs from @name to the opening
+ * parenthesis just before @arg is @str.
+ */
+static int
+is_token(const char* name, const char* arg, const char* str)
+{
+        return arg - 1 - name == strlen(str) && strncmp(name, str, arg - 1 - name) == 0;
+}
+
+/**
+ * Draws a rectangle of @size ("WxH") on canvas @c at its position, and
+ * moves the position past it.
+ *
+ * @param   color     Color of the rectangle, as in the pixels
+ * @param   outline   Non-zero to draw only the outline
+ * @return  Zero on success, -1 if the rectangle is outside the canvas.
+ */
+static int
+draw_rectangle(canvas* c, unsigned int color, const char* size, int outline)
+{
+        char* end = NULL;
+        int w = strtol(size, &end, 10);
+        int h = *end == 'x' ? strtol(end + 1, NULL, 10) : -1;
+        int top = (CANVAS_HEIGHT - h) / 2;
+        int x = 0;
+        int y = 0;
+
+        if (w < 0 || h < 0 || h > CANVAS_HEIGHT || c->x < 0 || c->x + w > CANVAS_WIDTH)
+        {
+                return -1;
+        }
+        for (y = top; y < top + h; y++)
+        {
+                for (x = c->x; x < c->x + w; x++)
+                {
+                        if (!outline || y == top || y == top + h - 1
+                            || x == c->x || x == c->x + w - 1)
+                        {
+                                c->pixels[y][x] = color;
+                        }
+                }
+        }
+        c->x += w;
+        return 0;
+}
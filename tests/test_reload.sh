@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+# Test for reloading the options of gmmembar on SIGHUP.
+#
+# The colors of the sections are given in a file with --config, which
+# is changed before the reload, so the frames after the reload must have
+# the new colors.  The command line is parsed again too, so parsing it
+# must not modify it; checks that it is intact after the reload.
+# Finally, a reload with an unknown option in the file must leave the
+# program running.
+#
+# Usage: test_reload.sh [gmmembar]
+
+GMMEMBAR=${1:-../src/gmmembar}
+OUT=`mktemp` || exit 1
+CONF=`mktemp` || exit 1
+
+fail()
+{
+        echo "test_reload: $*" >&2
+        kill $PID 2>/dev/null
+        rm -f "$OUT" "$CONF"
+        exit 1
+}
+
+# the colors of the sections in a frame, in order
+colors()
+{
+        grep -o '\^fg([^)]*)' | tr -d '\n'
+}
+
+cat > "$CONF" <<END
+# sections
+fields=used:orange,buffers:blue,cached:green
+END
+
+"$GMMEMBAR" --config="$CONF" --width=1000 --interval=100ms > "$OUT" 2>/dev/null &
+PID=$!
+sleep 0.3
+
+EXPECTED="$GMMEMBAR --config=$CONF --width=1000 --interval=100ms "
+FRAME_BEFORE=`tail -n 1 "$OUT" | colors`
+
+echo "--fields=used:purple,buffers:cyan,cached:white" > "$CONF"
+kill -HUP $PID || fail "gmmembar is not running"
+sleep 0.5
+
+AFTER=`tr '\0' ' ' < /proc/$PID/cmdline` || fail "gmmembar exited on SIGHUP"
+FRAME_AFTER=`tail -n 1 "$OUT" | colors`
+
+[ "$AFTER" = "$EXPECTED" ] || fail "command line changed on SIGHUP: $AFTER"
+case "$FRAME_BEFORE" in
+*'^fg(orange)'*'^fg(blue)'*'^fg(green)'*) ;;
+*) fail "sections before SIGHUP: $FRAME_BEFORE" ;;
+esac
+case "$FRAME_AFTER" in
+*'^fg(purple)'*'^fg(cyan)'*'^fg(white)'*) ;;
+*) fail "sections after SIGHUP: $FRAME_AFTER" ;;
+esac
+
+echo "no-such-option" > "$CONF"
+kill -HUP $PID || fail "gmmembar is not running"
+sleep 0.3
+kill -0 $PID 2>/dev/null || fail "gmmembar exited on an invalid option"
+
+kill $PID
+wait $PID
+rm -f "$OUT" "$CONF"
+echo "test_reload: 2 reloads, 0 failures"
@@ -0,0 +1,419 @@
+/*
+ * Test for the plan generations and multithreaded stress test for
+ * gmrenderer_format().
+ *
+ * The renderers tell plans apart by their generation, so every plan
+ * compiled must get a generation that no other plan has.  First, a
+ * single thread compiles plans over and over and checks that every
+ * generation is new.  Then the threads, pinned to different CPUs as far
+ * as there are CPUs, wait for each other and compile plans in a tight
+ * loop, so that they take generations at the same time; none of the
+ * generations may be taken twice.
+ *
+ * Finally each thread renders its own bars with its own renderer, half
+ * of them with the frame cache, recompiling every now and then, and
+ * every frame is compared against the frame rendered by gmbar_format()
+ * in a single thread beforehand.
+ *
+ * On a single CPU the threads only interleave when preempted, so a
+ * counter that is not updated atomically is unlikely to be caught by
+ * the concurrent part; the single-threaded part still catches one that
+ * does not hand out new generations.
+ *
+ * Usage: test_renderer [threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "libgmbar.h"
+
+/* Default number of threads */
+#define THREADS 8
+/* Number of plans compiled in a row by each thread */
+#define COMPILES 20000
+/* Number of bars, shared out between the threads */
+#define BARS 64
+/* Number of different frames of each bar */
+#define FRAMES 16
+/* Number of times each thread goes through the frames */
+#define ROUNDS 200
+/* Every this many frames, a bar is recompiled */
+#define RECOMPILE 7
+/* Room for the generations compiled by one thread */
+#define MAX_GENERATIONS (COMPILES + BARS * (1 + ROUNDS * FRAMES / RECOMPILE + 1))
+
+/**
+ * State of a thread.
+ */
+typedef struct worker worker;
+struct worker {
+        /** Thread */
+        pthread_t thread;
+        /** Index of the thread, the first bar of the thread */
+        unsigned int index;
+        /** Number of threads, the stride between the bars of a thread */
+        unsigned int nthreads;
+        /** Number of frames that differed */
+        unsigned long failures;
+        /** Generations of the plans compiled by the thread */
+        unsigned int* generations;
+        /** Number of generations */
+        unsigned int ngenerations;
+};
+
+/* Frames rendered in a single thread */
+static char* expected[BARS][FRAMES];
+
+/* Barrier the threads wait on before compiling */
+static pthread_barrier_t start;
+
+
+static unsigned long    check_sequential        ();
+static unsigned long    check_unique            (unsigned int* generations,
+                                                 unsigned int ngenerations);
+static int              start_workers           (worker* workers,
+                                                 unsigned int nthreads,
+                                                 unsigned int* ncpus);
+static gmbar*           make_bar                (unsigned int b);
+static void             set_frame               (gmbar* bar,
+                                                 unsigned int b,
+                                                 unsigned int f);
+static int              compile                 (gmbar* bar);
+static void*            run_worker              (void* data);
+static int              compare_uint            (const void* a,
+                                                 const void* b);
+
+
+int
+main(int argc, char** argv)
+{
+        unsigned int nthreads = argc > 1 ? atoi(argv[1]) : THREADS;
+        unsigned int ncpus = 0;
+        worker* workers = NULL;
+        unsigned int* generations = NULL;
+        unsigned int ngenerations = 0;
+        unsigned long failures = 0;
+        unsigned int b = 0;
+        unsigned int f = 0;
+        unsigned int i = 0;
+        int len = 0;
+        int max = 0;
+        gmbar* bar = NULL;
+
+        if (nthreads < 1 || nthreads > BARS)
+        {
+                nthreads = THREADS;
+        }
+
+        failures += check_sequential();
+
+        for (b = 0; b < BARS; b++)
+        {
+                bar = make_bar(b);
+                if (!bar)
+                {
+                        return 1;
+                }
+                for (f = 0; f < FRAMES; f++)
+                {
+                        len = max = 0;
+                        set_frame(bar, b, f);
+                        if (gmbar_format(bar, &expected[b][f], &len, &max) < 0)
+                        {
+                                return 1;
+                        }
+                }
+                gmbar_free(bar);
+        }
+
+        workers = calloc(nthreads, sizeof(worker));
+        generations = calloc(nthreads, MAX_GENERATIONS * sizeof(unsigned int));
+        if (!workers || !generations)
+        {
+                return 1;
+        }
+        for (i = 0; i < nthreads; i++)
+        {
+                workers[i].index = i;
+                workers[i].nthreads = nthreads;
+                workers[i].generations = generations + i * MAX_GENERATIONS;
+        }
+        if (start_workers(workers, nthreads, &ncpus))
+        {
+                return 1;
+        }
+        for (i = 0; i < nthreads; i++)
+        {
+                pthread_join(workers[i].thread, NULL);
+                failures += workers[i].failures;
+        }
+
+        /* the generations were stored per thread; gather them */
+        for (i = 0; i < nthreads; i++)
+        {
+                memmove(generations + ngenerations, workers[i].generations,
+                        workers[i].ngenerations * sizeof(unsigned int));
+                ngenerations += workers[i].ngenerations;
+        }
+        failures += check_unique(generations, ngenerations);
+
+        printf("test_renderer: %u threads on %u CPUs, %u plans, %lu failures\n",
+               nthreads, ncpus, ngenerations, failures);
+
+        for (b = 0; b < BARS; b++)
+        {
+                for (f = 0; f < FRAMES; f++)
+                {
+                        free(expected[b][f]);
+                }
+        }
+        free(generations);
+        free(workers);
+        pthread_barrier_destroy(&start);
+        return failures ? 1 : 0;
+}
+
+/**
+ * Compiles the plans of two bars in turns in this thread, and checks
+ * that every plan gets a generation that no plan had before.
+ *
+ * @return  Number of failures.
+ */
+static unsigned long
+check_sequential()
+{
+        unsigned int generations[2 * RECOMPILE * FRAMES];
+        unsigned int i = 0;
+        gmbar* bars[2] = { make_bar(0), make_bar(1) };
+
+        if (!bars[0] || !bars[1])
+        {
+                return 1;
+        }
+        for (i = 0; i < sizeof(generations) / sizeof(generations[0]); i++)
+        {
+                if (compile(bars[i % 2]))
+                {
+                        return 1;
+                }
+                generations[i] = bars[i % 2]->plan.generation;
+        }
+        gmbar_free(bars[0]);
+        gmbar_free(bars[1]);
+
+        return check_unique(generations, i);
+}
+
+/**
+ * Sorts @generations and reports those that appear more than once.
+ *
+ * @return  Number of failures.
+ */
+static unsigned long
+check_unique(unsigned int* generations, unsigned int ngenerations)
+{
+        unsigned long failures = 0;
+        unsigned int i = 0;
+
+        qsort(generations, ngenerations, sizeof(unsigned int), compare_uint);
+        for (i = 1; i < ngenerations; i++)
+        {
+                if (generations[i] == generations[i - 1])
+                {
+                        fprintf(stderr, "generation %u compiled twice\n", generations[i]);
+                        failures++;
+                }
+        }
+        return failures;
+}
+
+/**
+ * Starts the threads, pinned in turns to the CPUs this process may run
+ * on, if there is more than one.
+ *
+ * @param   ncpus   Set to the number of CPUs the threads run on
+ * @return  Zero on success, non-zero on failure.
+ */
+static int
+start_workers(worker* workers, unsigned int nthreads, unsigned int* ncpus)
+{
+        cpu_set_t allowed;
+        cpu_set_t set;
+        pthread_attr_t attr;
+        unsigned int cpu = 0;
+        unsigned int i = 0;
+        int err = 0;
+
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        {
+                CPU_SET(0, &allowed);
+        }
+        *ncpus = CPU_COUNT(&allowed);
+        if (pthread_barrier_init(&start, NULL, nthreads))
+        {
+                return 1;
+        }
+
+        for (i = 0; i < nthreads && !err; i++)
+        {
+                err = pthread_attr_init(&attr);
+                if (err)
+                {
+                        break;
+                }
+                if (*ncpus > 1)
+                {
+                        /* the next allowed CPU, going round */
+                        do
+                        {
+                                cpu = (cpu + 1) % CPU_SETSIZE;
+                        }
+                        while (!CPU_ISSET(cpu, &allowed));
+                        CPU_ZERO(&set);
+                        CPU_SET(cpu, &set);
+                        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+                }
+                err = pthread_create(&workers[i].thread, &attr, run_worker, &workers[i]);
+                pthread_attr_destroy(&attr);
+        }
+        return err;
+}
+
+/**
+ * Creates bar @b: the size, colors, segments and granularity depend
+ * on @b.
+ */
+static gmbar*
+make_bar(unsigned int b)
+{
+        gmbar* bar = gmbar_new_with_defaults(100 + b, 10, b % 2 ? "red" : "none", "#222222", 4);
+        if (!bar || gmbar_add_sections(bar, 4, "red", "orange", "yellow", "none"))
+        {
+                gmbar_free(bar);
+                return NULL;
+        }
+        gmbar_set_segments(bar, b % 3, b % 4);
+        gmbar_set_granularity(bar, b % 5, 0);
+        return bar;
+}
+
+/**
+ * Sets the section widths of frame @f of bar @b.
+ */
+static void
+set_frame(gmbar* bar, unsigned int b, unsigned int f)
+{
+        unsigned int values[] = { f * 7 + b, f * 3, b, 200 };
+
+        gmbar_set_section_widths(bar, 400, values);
+}
+
+/**
+ * Throws away the plan of @bar and compiles a new one.
+ *
+ * @return  Zero on success, non-zero on failure.
+ */
+static int
+compile(gmbar* bar)
+{
+        gmbar_invalidate(bar);
+        return gmbar_format_size(bar) < 0 || !bar->plan.valid;
+}
+
+/**
+ * Compiles plans in a tight loop, then renders the bars of a thread in
+ * turns and compares the frames.
+ */
+static void*
+run_worker(void* data)
+{
+        worker* self = data;
+        gmbar* bars[BARS];
+        unsigned int nbars = 0;
+        unsigned int generation = 0;
+        unsigned int round = 0;
+        unsigned int b = 0;
+        unsigned int f = 0;
+        unsigned int i = 0;
+        unsigned int k = 0;
+        gmrenderer* renderer = gmrenderer_new();
+
+        if (!renderer || gmrenderer_set_cache(renderer, self->index % 2 ? 4 : 0, 0))
+        {
+                self->failures++;
+        }
+        for (b = self->index; b < BARS; b += self->nthreads)
+        {
+                bars[nbars] = make_bar(b);
+                if (!bars[nbars])
+                {
+                        self->failures++;
+                        break;
+                }
+                nbars++;
+        }
+
+        /* all the threads compile at the same time */
+        pthread_barrier_wait(&start);
+        for (k = 0; k < COMPILES && nbars; k++)
+        {
+                if (compile(bars[0]))
+                {
+                        self->failures++;
+                        break;
+                }
+                self->generations[self->ngenerations++] = bars[0]->plan.generation;
+        }
+
+        /* on odd rounds, each bar goes through the frames in a row, so
+         * that the cache gets hits; on even rounds, the bars take turns */
+        for (round = 0; round < ROUNDS && renderer && !self->failures; round++)
+        {
+                for (k = 0; k < nbars * FRAMES; k++)
+                {
+                        i = round % 2 ? k / FRAMES : k % nbars;
+                        f = round % 2 ? k % FRAMES : k / nbars;
+                        f = f * (round + 1) % FRAMES;
+                        b = self->index + i * self->nthreads;
+                        if ((round + k) % RECOMPILE == 0)
+                        {
+                                gmbar_invalidate(bars[i]);
+                        }
+                        generation = bars[i]->plan.valid ? bars[i]->plan.generation : 0;
+                        set_frame(bars[i], b, f);
+                        if (gmrenderer_format(renderer, bars[i]) < 0
+                            || strcmp(renderer->buf, expected[b][f]) != 0)
+                        {
+                                self->failures++;
+                        }
+                        if (bars[i]->plan.generation != generation
+                            && self->ngenerations < MAX_GENERATIONS)
+                        {
+                                self->generations[self->ngenerations++] = bars[i]->plan.generation;
+                        }
+                }
+        }
+
+        for (i = 0; i < nbars; i++)
+        {
+                gmbar_free(bars[i]);
+        }
+        gmrenderer_free(renderer);
+        return NULL;
+}
+
+/**
+ * qsort() comparison for unsigned ints.
+ */
+static int
+compare_uint(const void* a, const void* b)
+{
+        unsigned int x = *(const unsigned int*) a;
+        unsigned int y = *(const unsigned int*) b;
+
+        return x < y ? -1 : x > y;
+}
@@ -0,0 +1,223 @@
+/*
+ * Test for gmbar_set_section_widths().
+ *
+ * Checks fixed cases, including totals large enough to overflow 32 bit
+ * arithmetic, and then the properties of the widths for random bars:
+ * every section is a multiple of granularity and within one unit of its
+ * exact share, the sections never overflow the inner width, and together
+ * they are the rounded sum of the values.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libgmbar.h"
+
+/* Number of random bars to check */
+#define ITERATIONS 200000
+
+/**
+ * Fixed case: bar width, granularity, total, values, and the expected
+ * widths.
+ */
+typedef struct widths_case widths_case;
+struct widths_case {
+        unsigned int width;
+        unsigned int granularity;
+        unsigned int total;
+        unsigned int values[3];
+        unsigned int widths[3];
+};
+
+static const widths_case cases[] = {
+        { 100, 0,  100,         { 25, 50, 25 },                         { 25, 50, 25 } },
+        { 100, 0,  3,           { 1, 1, 1 },                            { 34, 33, 33 } },
+        { 100, 10, 100,         { 44, 32, 9 },                          { 50, 30, 10 } },
+        { 100, 0,  0,           { 1, 2, 3 },                            { 0, 0, 0 } },
+        { 10,  0,  100,         { 100, 100, 100 },                      { 10, 0, 0 } },
+        /* the rounding of the sum overflowed 32 bits with large totals */
+        { 100, 10, 16000000,    { 8000000, 4800000, 1440000 },          { 50, 30, 10 } },
+        { 100, 10, 4000000000u, { 2000000000, 1200000000, 360000000 },  { 50, 30, 10 } },
+        { 100, 4,  4000000000u, { 1000000000, 1000000000, 1000000000 }, { 28, 24, 24 } },
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+
+static int            check_cases     ();
+static int            check_random    ();
+static unsigned int   random_below    (unsigned int n);
+
+
+int
+main()
+{
+        int failures = 0;
+
+        failures += check_cases();
+        failures += check_random();
+
+        printf("test_widths: %u cases, %d random bars, %d failures\n",
+               (unsigned int) COUNT(cases), ITERATIONS, failures);
+        return failures ? 1 : 0;
+}
+
+/**
+ * Checks the fixed cases.
+ *
+ * @return  Number of failures.
+ */
+static int
+check_cases()
+{
+        const widths_case* c = NULL;
+        gmbar* bar = NULL;
+        unsigned int i = 0;
+        unsigned int j = 0;
+        int failures = 0;
+
+        for (i = 0; i < COUNT(cases); i++)
+        {
+                c = &cases[i];
+                bar = gmbar_new_with_defaults(c->width, 10, "red", "none", 3);
+                if (!bar || gmbar_add_sections(bar, 3, "red", "orange", "yellow"))
+                {
+                        return 1;
+                }
+                gmbar_set_granularity(bar, c->granularity, 0);
+                gmbar_set_section_widths(bar, c->total, c->values);
+
+                for (j = 0; j < 3; j++)
+                {
+                        if (bar->sections[j].width != c->widths[j])
+                        {
+                                fprintf(stderr, "case %u: widths %u %u %u, expected %u %u %u\n", i,
+                                        bar->sections[0].width, bar->sections[1].width,
+                                        bar->sections[2].width,
+                                        c->widths[0], c->widths[1], c->widths[2]);
+                                failures++;
+                                break;
+                        }
+                }
+                gmbar_free(bar);
+        }
+        return failures;
+}
+
+/**
+ * Checks the properties of the widths for random bars.
+ *
+ * @return  Number of failures.
+ */
+static int
+check_random()
+{
+        unsigned int values[8];
+        unsigned long long sum = 0;
+        unsigned long long widths = 0;
+        unsigned long long units = 0;
+        unsigned int total = 0;
+        unsigned int granularity = 0;
+        unsigned int unit = 0;
+        unsigned int width = 0;
+        unsigned int n = 0;
+        unsigned int i = 0;
+        int inner = 0;
+        int iteration = 0;
+        int failures = 0;
+        double exact = 0;
+        gmbar* bar = NULL;
+
+        for (iteration = 0; iteration < ITERATIONS && failures < 10; iteration++)
+        {
+                width = 1 + random_below(500);
+                n = 1 + random_below(8);
+                bar = gmbar_new_with_defaults(width, 10, "red", "none", n);
+                if (!bar)
+                {
+                        return 1;
+                }
+
+                sum = 0;
+                for (i = 0; i < n; i++)
+                {
+                        gmbar_add_section(bar, "red");
+                        values[i] = random_below(3) == 0
+                                ? 0 : random_below(random_below(2) ? 100 : 4000000000u / 8);
+                        sum += values[i];
+                }
+                /* the values add up to the total, to less, or to more */
+                switch (random_below(3))
+                {
+                case 0:
+                        total = sum;
+                        break;
+                case 1:
+                        total = sum + random_below(1000);
+                        break;
+                default:
+                        total = sum - sum / 3;
+                        break;
+                }
+                granularity = random_below(3) == 0 ? 1 + random_below(10) : 0;
+                unit = granularity ? granularity : 1;
+                gmbar_set_granularity(bar, granularity, 0);
+                gmbar_set_padding(bar, (gmmargin) { 0, 0, 0, random_below(3) });
+                inner = width - bar->padding.left;
+                if (inner < 0)
+                {
+                        inner = 0;
+                }
+
+                gmbar_set_section_widths(bar, total, values);
+
+                widths = 0;
+                for (i = 0; i < n; i++)
+                {
+                        widths += bar->sections[i].width;
+                        exact = total ? (double) inner * values[i] / total : 0;
+                        if (bar->sections[i].width % unit
+                            || bar->sections[i].width > exact + unit + 1e-9
+                            || (total >= sum && bar->sections[i].width + unit < exact - 1e-9))
+                        {
+                                fprintf(stderr, "bar %d: section %u is %u pixels, exact %f, unit %u\n",
+                                        iteration, i, bar->sections[i].width, exact, unit);
+                                failures++;
+                                break;
+                        }
+                }
+
+                /* the sum of the values, rounded to half a unit */
+                units = 0;
+                if (total)
+                {
+                        units = (2 * (unsigned __int128) sum * inner
+                                 + (granularity ? (unsigned __int128) total * granularity : 0))
+                                / (2 * (unsigned __int128) total * unit);
+                }
+                if (units > inner / unit)
+                {
+                        units = inner / unit;
+                }
+                if (widths != units * unit)
+                {
+                        fprintf(stderr, "bar %d: sections are %llu pixels, expected %llu\n",
+                                iteration, widths, units * unit);
+                        failures++;
+                }
+
+                gmbar_free(bar);
+        }
+        return failures;
+}
+
+/**
+ * Returns a pseudo random number below @n, the same sequence every run.
+ */
+static unsigned int
+random_below(unsigned int n)
+{
+        static unsigned int seed = 1;
+
+        seed = seed * 1103515245 + 12345;
+        return n ? (seed >> 8) % n : 0;
+}